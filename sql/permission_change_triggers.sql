@@ -0,0 +1,59 @@
+-- Triggers sending the `NOTIFY`s the API's permission caches are invalidated
+-- by (see `stickers::listen_for_permission_changes()`); the caches must stay
+-- disabled (`auth.permission_cache_size` of 0) unless these are installed, or
+-- role & permission changes won't be seen until the API is restarted
+
+
+CREATE OR REPLACE FUNCTION users.notify_user_role_changed()
+RETURNS TRIGGER AS $$
+BEGIN
+    PERFORM pg_notify( 'user_role_changed', OLD.user_id::TEXT );
+    RETURN NULL;
+END;
+$$ LANGUAGE plpgsql;
+
+DROP TRIGGER IF EXISTS notify_user_role_changed ON users.users;
+CREATE TRIGGER notify_user_role_changed
+    AFTER UPDATE OF user_role_id, deleted OR DELETE
+    ON users.users
+    FOR EACH ROW
+    EXECUTE PROCEDURE users.notify_user_role_changed();
+
+
+CREATE OR REPLACE FUNCTION permissions.notify_role_permissions_changed()
+RETURNS TRIGGER AS $$
+BEGIN
+    IF TG_OP IN ( 'UPDATE', 'DELETE' ) THEN
+        PERFORM pg_notify( 'role_permissions_changed', OLD.role_id::TEXT );
+    END IF;
+    IF TG_OP IN ( 'INSERT', 'UPDATE' ) THEN
+        PERFORM pg_notify( 'role_permissions_changed', NEW.role_id::TEXT );
+    END IF;
+    RETURN NULL;
+END;
+$$ LANGUAGE plpgsql;
+
+DROP TRIGGER IF EXISTS notify_role_permissions_changed
+    ON permissions.role_permissions;
+CREATE TRIGGER notify_role_permissions_changed
+    AFTER INSERT OR UPDATE OR DELETE
+    ON permissions.role_permissions
+    FOR EACH ROW
+    EXECUTE PROCEDURE permissions.notify_role_permissions_changed();
+
+
+-- Renaming a permission can affect any role, so invalidate them all
+CREATE OR REPLACE FUNCTION permissions.notify_permission_renamed()
+RETURNS TRIGGER AS $$
+BEGIN
+    PERFORM pg_notify( 'role_permissions_changed', '' );
+    RETURN NULL;
+END;
+$$ LANGUAGE plpgsql;
+
+DROP TRIGGER IF EXISTS notify_permission_renamed ON permissions.permissions;
+CREATE TRIGGER notify_permission_renamed
+    AFTER UPDATE OF permission OR DELETE
+    ON permissions.permissions
+    FOR EACH STATEMENT
+    EXECUTE PROCEDURE permissions.notify_permission_renamed();
@@ -4,7 +4,6 @@
 #include "design.hpp"
 
 #include "../api/person.hpp"
-#include "../common/formatting.hpp"
 #include "../common/logging.hpp"
 
 #include <algorithm>    // std::set_difference()
@@ -12,6 +11,131 @@
 #include <tuple>
 
 
+namespace // Statements ////////////////////////////////////////////////////////
+{
+    const stickers::postgres::statement load_design_images_query{
+        "load_design_images",
+        PSQL(
+            SELECT image_hash
+            FROM designs.design_images
+            WHERE
+                design_id = $1
+                AND NOT deleted
+            ORDER BY weight
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement load_design_contributors_query{
+        "load_design_contributors",
+        PSQL(
+            SELECT person_id
+            FROM designs.design_contributors
+            WHERE
+                design_id = $1
+                AND NOT deleted
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement create_design_query{
+        "create_design",
+        PSQL(
+            INSERT INTO designs.designs_core (
+                design_id,
+                _a_revision
+            )
+            VALUES (
+                DEFAULT,
+                $1
+            )
+            RETURNING design_id
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement add_design_revision_query{
+        "add_design_revision",
+        PSQL(
+            INSERT INTO designs.design_revisions (
+                design_id,
+                revised,
+                revised_by,
+                revised_from,
+                description
+            )
+            VALUES ( $1, $2, $3, $4, $5 )
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement remove_design_contributors_query{
+        "remove_design_contributors",
+        PSQL(
+            UPDATE designs.design_contributor_revisions
+            SET
+                removed      = $2,
+                removed_by   = $3,
+                removed_from = $4
+            WHERE
+                design_id = $1
+                AND person_id = ANY( $5::BIGINT[] )
+                AND removed IS NULL
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement load_design_query{
+        "load_design",
+        PSQL(
+            SELECT
+                created,
+                revised,
+                description
+            FROM designs.designs
+            WHERE
+                design_id = $1
+                AND NOT deleted
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement delete_design_query{
+        "delete_design",
+        PSQL(
+            INSERT INTO designs.design_deletions (
+                design_id,
+                deleted,
+                deleted_by,
+                deleted_from
+            )
+            VALUES ( $1, $2, $3, $4 )
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement assert_designs_exist_query{
+        "assert_designs_exist",
+        PSQL(
+            WITH lookfor AS (
+                SELECT UNNEST( $1::BIGINT[] ) AS design_id
+            )
+            SELECT lookfor.design_id
+            FROM
+                lookfor
+                LEFT JOIN designs.designs_core AS dc
+                    ON dc.design_id = lookfor.design_id
+                LEFT JOIN designs.design_deletions AS dd
+                    ON dd.design_id = dc.design_id
+            WHERE
+                   dc.design_id IS     NULL
+                OR dd.design_id IS NOT NULL
+            ;
+        )
+    };
+}
+
+
 namespace
 {
     std::vector< stickers::sha256 > get_images_for_design(
@@ -19,16 +143,9 @@ namespace
         pqxx::work& transaction
     )
     {
-        auto result{ transaction.exec_params(
-            PSQL(
-                SELECT image_hash
-                FROM designs.design_images
-                WHERE
-                    design_id = $1
-                    AND NOT deleted
-                ORDER BY weight
-                ;
-            ),
+        auto result{ stickers::postgres::exec(
+            transaction,
+            load_design_images_query,
             id
         ) };
         
@@ -45,15 +162,9 @@ namespace
         pqxx::work& transaction
     )
     {
-        auto result{ transaction.exec_params(
-            PSQL(
-                SELECT person_id
-                FROM designs.design_contributors
-                WHERE
-                    design_id = $1
-                    AND NOT deleted
-                ;
-            ),
+        auto result{ stickers::postgres::exec(
+            transaction,
+            load_design_contributors_query,
             id
         ) };
         
@@ -73,24 +184,14 @@ namespace
         bool                          generate_id
     )
     {
-        auto connection{ stickers::postgres::connect() };
-        pqxx::work transaction{ *connection };
+        stickers::postgres::transaction_scope scope;
+        auto& transaction{ *scope };
         
         if( generate_id )
         {
-            auto result{ transaction.exec_params(
-                PSQL(
-                    INSERT INTO designs.designs_core (
-                        design_id,
-                        _a_revision
-                    )
-                    VALUES (
-                        DEFAULT,
-                        $1
-                    )
-                    RETURNING design_id
-                    ;
-                ),
+            auto result{ stickers::postgres::exec(
+                transaction,
+                create_design_query,
                 blame.when
             ) };
             result[ 0 ][ "design_id" ].to< stickers::bigid >( design.id );
@@ -98,18 +199,9 @@ namespace
         else
             stickers::assert_designs_exist( transaction, { design.id } );
         
-        transaction.exec_params(
-            PSQL(
-                INSERT INTO designs.design_revisions (
-                    design_id,
-                    revised,
-                    revised_by,
-                    revised_from,
-                    description
-                )
-                VALUES ( $1, $2, $3, $4, $5 )
-                ;
-            ),
+        stickers::postgres::exec(
+            transaction,
+            add_design_revision_query,
             design.id,
             blame.when,
             blame.who,
@@ -181,33 +273,16 @@ namespace
         {
             // No need to check these exist, they were just pulled from the DB
             
-            std::string query_string;
-            ff::fmt(
-                query_string,
-                PSQL(
-                    UPDATE designs.design_contributor_revisions
-                    SET
-                        removed      = $2
-                        removed_by   = $3
-                        removed_from = $4
-                    WHERE
-                        design_id = $1
-                        AND person_id IN ( {0} )
-                        AND removed IS NULL
-                    ;
-                ),
-                stickers::postgres::format_variable_list(
-                    transaction,
-                    contributors_to_remove
-                )
-            );
-            
-            transaction.exec_params(
-                query_string,
+            stickers::postgres::exec(
+                transaction,
+                remove_design_contributors_query,
                 design.id,
                 blame.when,
                 blame.who,
-                blame.where
+                blame.where,
+                stickers::postgres::format_array_parameter(
+                    contributors_to_remove
+                )
             );
         }
         
@@ -248,7 +323,7 @@ namespace
             inserter.complete();
         }
         
-        transaction.commit();
+        scope.commit();
         return design.id;
     }
 }
@@ -268,21 +343,12 @@ namespace stickers // Design ///////////////////////////////////////////////////
     
     design_info load_design( const bigid& id )
     {
-        auto connection{ postgres::connect() };
-        pqxx::work transaction{ *connection };
+        postgres::transaction_scope scope;
+        auto& transaction{ *scope };
         
-        auto result{ transaction.exec_params(
-            PSQL(
-                SELECT
-                    created,
-                    revised,
-                    description
-                FROM designs.designs
-                WHERE
-                    design_id = $1
-                    AND NOT deleted
-                ;
-            ),
+        auto result{ postgres::exec(
+            transaction,
+            load_design_query,
             id
         ) };
         
@@ -299,7 +365,7 @@ namespace stickers // Design ///////////////////////////////////////////////////
             get_contributors_for_design( id, transaction )
         };
         
-        transaction.commit();
+        scope.commit();
         
         return info;
     }
@@ -313,28 +379,20 @@ namespace stickers // Design ///////////////////////////////////////////////////
     
     void delete_design( const bigid& id, const audit::blame& blame )
     {
-        auto connection{ postgres::connect() };
-        pqxx::work transaction{ *connection };
+        postgres::transaction_scope scope;
+        auto& transaction{ *scope };
         
         assert_designs_exist( transaction, { id } );
         
-        auto result{ transaction.exec_params(
-            PSQL(
-                INSERT INTO designs.design_deletions (
-                    design_id,
-                    deleted,
-                    deleted_by,
-                    deleted_from
-                )
-                VALUES ( $1, $2, $3, $4 )
-                ;
-            ),
+        auto result{ postgres::exec(
+            transaction,
+            delete_design_query,
             id,
             blame.when,
             blame.who,
             blame.where
         ) };
-        transaction.commit();
+        scope.commit();
     }
 }
 
@@ -354,33 +412,14 @@ namespace stickers // Assertion ////////////////////////////////////////////////
 {
     void _assert_designs_exist_impl::exec(
         pqxx::work       & transaction,
-        const std::string& ids_string
+        const std::string& ids_array
     )
     {
-        std::string query_string;
-        
-        ff::fmt(
-            query_string,
-            PSQL(
-                WITH lookfor AS (
-                    SELECT UNNEST( ARRAY[ {0} ] ) AS design_id
-                )
-                SELECT lookfor.design_id
-                FROM
-                    lookfor
-                    LEFT JOIN designs.designs_core AS dc
-                        ON dc.design_id = lookfor.design_id
-                    LEFT JOIN designs.design_deletions AS dd
-                        ON dd.design_id = dc.design_id
-                WHERE
-                       dc.design_id IS     NULL
-                    OR dd.design_id IS NOT NULL
-                ;
-            ),
-            ids_string
-        );
-        
-        auto result{ transaction.exec( query_string ) };
+        auto result{ postgres::exec(
+            transaction,
+            assert_designs_exist_query,
+            ids_array
+        ) };
         
         if( result.size() > 0 )
             throw no_such_design{ result[ 0 ][ 0 ].as< bigid >() };
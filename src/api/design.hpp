@@ -57,7 +57,7 @@ namespace stickers
     {
         _assert_designs_exist_impl::exec(
             transaction,
-            postgres::format_variable_list( transaction, ids )
+            postgres::format_array_parameter( ids )
         );
     }
     
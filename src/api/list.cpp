@@ -7,6 +7,22 @@
 #include "../common/postgres.hpp"
 
 
+namespace // Statements ////////////////////////////////////////////////////////
+{
+    const stickers::postgres::statement load_user_list_query{
+        "load_user_list",
+        PSQL(
+            SELECT
+                product_id,
+                revised,
+                quantity
+            FROM lists.user_product_lists
+            WHERE user_id = $1
+        )
+    };
+}
+
+
 namespace
 {
     
@@ -17,24 +33,18 @@ namespace stickers
 {
     std::vector< list_entry > get_user_list( const bigid& user_id )
     {
+        postgres::transaction_scope scope;
+        auto& transaction{ *scope };
+        
         // Assert user exists
         auto user_info{ load_user( user_id ) };
         
-        auto connection = postgres::connect();
-        pqxx::work transaction{ *connection };
-        
-        auto result = transaction.exec_params(
-            PSQL(
-                SELECT
-                    product_id,
-                    revised,
-                    quantity
-                FROM lists.user_product_lists
-                WHERE user_id = $1
-            ),
+        auto result = postgres::exec(
+            transaction,
+            load_user_list_query,
             user_id
         );
-        transaction.commit();
+        scope.commit();
         
         std::vector< list_entry > list;
         
@@ -4,7 +4,6 @@
 #include "media.hpp"
 
 #include "../common/config.hpp"
-#include "../common/formatting.hpp"
 #include "../common/logging.hpp"
 #include "../common/uuid.hpp"
 #include "../handlers/handlers.hpp"
@@ -16,6 +15,59 @@
 
 #include <fstream>
 #include <sstream>
+#include <system_error>
+
+
+namespace // Statements ////////////////////////////////////////////////////////
+{
+    const stickers::postgres::statement load_media_info_query{
+        "load_media_info",
+        PSQL(
+            SELECT
+                mime_type,
+                decency,
+                original_filename,
+                uploaded,
+                uploaded_by
+            FROM media.images
+            WHERE image_hash = $1
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement add_media_query{
+        "add_media",
+        PSQL(
+            INSERT INTO media.images (
+                image_hash,
+                mime_type,
+                decency,
+                original_filename,
+                uploaded,
+                uploaded_by,
+                uploaded_from
+            )
+            VALUES ( $1, $2, $3, $4, $5, $6, $7 )
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement assert_media_exist_query{
+        "assert_media_exist",
+        PSQL(
+            WITH lookfor AS (
+                SELECT UNNEST( $1::BYTEA[] ) AS image_hash
+            )
+            SELECT lookfor.image_hash
+            FROM
+                lookfor
+                LEFT JOIN media.images AS img
+                    ON img.image_hash = lookfor.image_hash
+            WHERE img.image_hash IS NULL
+            ;
+        )
+    };
+}
 
 
 namespace // Utilities /////////////////////////////////////////////////////////
@@ -58,9 +110,7 @@ namespace // Utilities /////////////////////////////////////////////////////////
     )
     {
         return std::experimental::filesystem::u8path(
-            stickers::config()[ "media" ][ "media_directory" ].get<
-                std::string
-            >()
+            stickers::current_settings().media.media_directory
             + "/"
             + format_image_subpath( hash, mime_type )
         );
@@ -72,7 +122,7 @@ namespace // Utilities /////////////////////////////////////////////////////////
     )
     {
         return (
-            stickers::config()[ "media" ][ "base_url" ].get< std::string >()
+            stickers::current_settings().media.base_url
             + format_image_subpath( hash, mime_type )
         );
     }
@@ -151,18 +201,9 @@ namespace // Internal implementations //////////////////////////////////////////
         pqxx::work& transaction
     )
     {
-        auto result{ transaction.exec_params(
-            PSQL(
-                SELECT
-                    mime_type,
-                    decency,
-                    original_filename,
-                    uploaded,
-                    uploaded_by
-                FROM media.images
-                WHERE image_hash = $1
-                ;
-            ),
+        auto result{ stickers::postgres::exec(
+            transaction,
+            load_media_info_query,
             pqxx::binarystring{ hash.raw_digest() }
         ) };
         
@@ -205,9 +246,7 @@ namespace // Internal implementations //////////////////////////////////////////
         auto temp_file_id{ stickers::uuid::generate() };
         
         auto temp_file_path{ std::experimental::filesystem::u8path(
-            stickers::config()[ "media" ][ "temp_file_location" ].get<
-                std::string
-            >()
+            stickers::current_settings().media.temp_file_location
             + "/"
             + temp_file_id.hex_value()
         ) };
@@ -216,9 +255,30 @@ namespace // Internal implementations //////////////////////////////////////////
         );
         std::fstream temp_file{
             temp_file_path,
-            std::ios::out | std::ios::in | std::ios::binary
+            (
+                std::ios::out
+                | std::ios::in
+                | std::ios::trunc
+                | std::ios::binary
+            )
         };
         
+        // Nothing else checks the file, so a bad temp file location or a full
+        // disk would otherwise be stored as a truncated or empty file
+        auto fail{ [ &temp_file_path ]( const std::string& what ){
+            std::error_code error;
+            std::experimental::filesystem::remove( temp_file_path, error );
+            throw std::runtime_error{
+                what
+                + " temp file ""
+                + stickers::log_sanitize( temp_file_path )
+                + """
+            };
+        } };
+        
+        if( !temp_file )
+            fail( "could not open" );
+        
         std::istream file_stream{ &file_contents };
         std::streamsize file_size{ 0 };
         stickers::sha256::builder hash_builder;
@@ -238,6 +298,13 @@ namespace // Internal implementations //////////////////////////////////////////
         hash_builder.append( buffer, remaining );
         file_size += remaining;
         
+        // `std::istream` turns errors reading the upload (e.g. the client
+        // disconnecting) into `badbit` rather than letting them through
+        if( file_stream.bad() )
+            fail( "upload interrupted while writing" );
+        if( !temp_file.flush() )
+            fail( "could not write" );
+        
         STICKERS_LOG(
             stickers::log_level::VERBOSE,
             "wrote ",
@@ -301,53 +368,27 @@ namespace // Internal implementations //////////////////////////////////////////
         };
     }
     
-    file_info save_temp_file(
-        std::string                       & file_contents,
-        const std::optional< std::string >& original_filename,
-        const std::optional< std::string >& sent_mime_type
-    )
+    // Removes a temp file on scope exit unless it's already been moved to its
+    // final location, e.g. when the media already existed or saving failed
+    struct temp_file_guard
     {
-        auto mime_type{ guess_mime_type(
-            original_filename,
-            sent_mime_type,
-            file_contents.substr( 0, 64 ),
-            file_contents.substr(
-                file_contents.size() - 64
-            )
-        ) };
-        auto file_hash{ stickers::sha256::make( file_contents ) };
-        auto temp_file_id{ stickers::uuid::generate() };
-        
-        auto temp_file_path{ std::experimental::filesystem::u8path(
-            stickers::config()[ "media" ][ "temp_file_location" ].get<
-                std::string
-            >()
-            + "/"
-            + temp_file_id.hex_value()
-        ) };
-        
-        std::fstream temp_file{
-            temp_file_path,
-            std::ios::out | std::ios::binary
-        };
-        
-        temp_file.write( file_contents.data(), file_contents.size() );
+        std::experimental::filesystem::path path;
         
-        STICKERS_LOG(
-            stickers::log_level::VERBOSE,
-            "wrote ",
-            file_contents.size(),
-            " bytes to temp file \"",
-            stickers::log_sanitize( temp_file_path ),
-            "\""
-        );
-        
-        return {
-            temp_file_path,
-            file_hash,
-            mime_type
-        };
-    }
+        ~temp_file_guard()
+        {
+            std::error_code error;
+            if(
+                !path.empty()
+                && std::experimental::filesystem::remove( path, error )
+            )
+                STICKERS_LOG(
+                    stickers::log_level::VERBOSE,
+                    "removed temp file \"",
+                    stickers::log_sanitize( path ),
+                    "\""
+                );
+        }
+    };
     
     stickers::media save_media_impl(
         const std::experimental::filesystem::path& temp_file_path,
@@ -358,8 +399,8 @@ namespace // Internal implementations //////////////////////////////////////////
         const stickers::audit::blame             & blame
     )
     {
-        auto connection{ stickers::postgres::connect() };
-        pqxx::work transaction{ *connection };
+        stickers::postgres::transaction_scope scope;
+        auto& transaction{ *scope };
         
         try
         {
@@ -371,20 +412,9 @@ namespace // Internal implementations //////////////////////////////////////////
         }
         catch( const stickers::no_such_media& e ) {}
         
-        transaction.exec_params(
-            PSQL(
-                INSERT INTO media.images (
-                    image_hash,
-                    mime_type,
-                    decency,
-                    original_filename,
-                    uploaded,
-                    uploaded_by,
-                    uploaded_from
-                )
-                VALUES ( $1, $2, $3, $4, $5, $6, $7 )
-                ;
-            ),
+        stickers::postgres::exec(
+            transaction,
+            add_media_query,
             pqxx::binarystring{ file_hash.raw_digest() },
             mime_type,
             decency,
@@ -414,7 +444,7 @@ namespace // Internal implementations //////////////////////////////////////////
         );
         
         // Commit transaction _after_ moving file
-        transaction.commit();
+        scope.commit();
         
         STICKERS_LOG(
             stickers::log_level::INFO,
@@ -455,6 +485,7 @@ namespace stickers // Media ////////////////////////////////////////////////////
             original_filename,
             mime_type
         ) };
+        temp_file_guard guard{ info.temp_file_path };
         
         return save_media_impl(
             info.temp_file_path,
@@ -471,36 +502,61 @@ namespace stickers // Media ////////////////////////////////////////////////////
         const audit::blame& blame
     )
     {
-        auto upload_doc{ parse_request_content( upload_request ) };
-        
-        if( !upload_doc.is_a< stickers::map_document >() )
-            throw stickers::handler_exit{
-                show::code::BAD_REQUEST,
-                "invalid data format"
-            };
-        
-        auto& upload_map{ upload_doc.get< stickers::map_document >() };
+        // Stream the file segment straight to disk as it arrives rather than
+        // buffering the whole upload; the only other field is tiny
+        std::optional< file_info   > saved_file;
+        std::optional< std::string > original_filename;
+        std::optional< std::string > decency_field;
+        temp_file_guard              guard;
+        
+        for_each_multipart_segment(
+            upload_request,
+            [ & ](
+                std::streambuf               & segment,
+                const multipart_segment_info & segment_info
+            ){
+                if( segment_info.name == "file" && !saved_file )
+                {
+                    if( !segment_info.mime_type )
+                        throw handler_exit{
+                            show::code::BAD_REQUEST,
+                            "required field \"file\" must be a binary segment"
+                        };
+                    
+                    saved_file = save_temp_file(
+                        segment,
+                        segment_info.filename,
+                        segment_info.mime_type
+                    );
+                    original_filename = segment_info.filename;
+                    guard.path        = saved_file -> temp_file_path;
+                }
+                else if( segment_info.name == "decency" && !decency_field )
+                {
+                    // Longer than any valid value, but bounded
+                    char buffer[ 32 ];
+                    auto length{ segment.sgetn( buffer, sizeof( buffer ) ) };
+                    if( length == sizeof( buffer ) )
+                        throw handler_exit{
+                            show::code::BAD_REQUEST,
+                            "required field \"decency\" is too long"
+                        };
+                    decency_field = std::string( buffer, length );
+                }
+            }
+        );
         
-        auto found_decency_field = upload_map.find( "decency" );
         auto decency{ media_decency::SAFE };
-        if( found_decency_field == upload_map.end() )
+        if( !decency_field )
             throw handler_exit{
                 show::code::BAD_REQUEST,
                 "missing required field \"decency\""
             };
-        
-        auto& decency_field{ found_decency_field -> second };
-        
-        if( !decency_field.is_a< string_document >() )
-            throw handler_exit{
-                show::code::BAD_REQUEST,
-                "required field \"decency\" must be a string"
-            };
-        else if( decency_field.get< string_document >() == "safe" )
+        else if( *decency_field == "safe" )
             decency = media_decency::SAFE;
-        else if( decency_field.get< string_document >() == "questionable" )
+        else if( *decency_field == "questionable" )
             decency = media_decency::QUESTIONABLE;
-        else if( decency_field.get< string_document >() == "explicit" )
+        else if( *decency_field == "explicit" )
             decency = media_decency::EXPLICIT;
         else
             throw handler_exit{
@@ -511,45 +567,26 @@ namespace stickers // Media ////////////////////////////////////////////////////
                 )
             };
         
-        // TODO: `stickers::file_document` type
-        auto found_file_field{ upload_map.find( "file" ) };
-        if( found_file_field == upload_map.end() )
+        if( !saved_file )
             throw handler_exit{
                 show::code::BAD_REQUEST,
                 "missing required field \"file\""
             };
         
-        auto& file_field{ found_file_field -> second };
-        
-        if(
-            !file_field.is_a< string_document >()
-            || !file_field.mime_type
-        )
-            throw handler_exit{
-                show::code::BAD_REQUEST,
-                "required field \"file\" must be a binary segment"
-            };
-        
-        auto info{ save_temp_file(
-            file_field.get< string_document >(),
-            file_field.name,
-            file_field.mime_type
-        ) };
-        
         return save_media_impl(
-            info.temp_file_path,
-            info.file_hash,
-            info.mime_type,
+            saved_file -> temp_file_path,
+            saved_file -> file_hash,
+            saved_file -> mime_type,
             decency,
-            file_field.name,
+            original_filename,
             blame
         );
     }
     
     media_info load_media_info( const sha256& hash )
     {
-        auto connection{ postgres::connect() };
-        pqxx::work transaction{ *connection };
+        postgres::transaction_scope scope;
+        auto& transaction{ *scope };
         
         return load_media_info_impl( hash, transaction );
     }
@@ -586,29 +623,14 @@ namespace stickers // Assertion ////////////////////////////////////////////////
 {
     void _assert_media_exist_impl::exec(
         pqxx::work       & transaction,
-        const std::string& ids_string
+        const std::string& ids_array
     )
     {
-        std::string query_string;
-        
-        ff::fmt(
-            query_string,
-            PSQL(
-                WITH lookfor AS (
-                    SELECT UNNEST( ARRAY[ {0} ] ) AS image_hash
-                )
-                SELECT lookfor.image_hash
-                FROM
-                    lookfor
-                    LEFT JOIN media.images AS img
-                        ON img.image_hash = lookfor.image_hash
-                WHERE img.image_hash IS NULL
-                ;
-            ),
-            ids_string
-        );
-        
-        auto result{ transaction.exec( query_string ) };
+        auto result{ postgres::exec(
+            transaction,
+            assert_media_exist_query,
+            ids_array
+        ) };
         
         if( result.size() > 0 )
             throw no_such_media{ result[ 0 ][ 0 ].as< sha256 >() };
@@ -80,7 +80,7 @@ namespace stickers
     {
         _assert_media_exist_impl::exec(
             transaction,
-            postgres::format_variable_list( transaction, hashes )
+            postgres::format_array_parameter( hashes )
         );
     }
     
@@ -4,10 +4,97 @@
 #include "person.hpp"
 
 #include "../api/user.hpp"
-#include "../common/formatting.hpp"
 #include "../common/logging.hpp"
 
 
+namespace // Statements ////////////////////////////////////////////////////////
+{
+    const stickers::postgres::statement create_person_query{
+        "create_person",
+        PSQL(
+            INSERT INTO people.people_core (
+                person_id,
+                _a_revision
+            )
+            VALUES (
+                DEFAULT,
+                $1
+            )
+            RETURNING person_id
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement add_person_revision_query{
+        "add_person_revision",
+        PSQL(
+            INSERT INTO people.person_revisions (
+                person_id,
+                revised,
+                revised_by,
+                revised_from,
+                person_name,
+                person_user,
+                about
+            )
+            VALUES ( $1, $2, $3, $4, $5, $6, $7 )
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement load_person_query{
+        "load_person",
+        PSQL(
+            SELECT
+                created,
+                revised,
+                person_name,
+                person_user,
+                about
+            FROM people.people
+            WHERE
+                person_id = $1
+                AND NOT deleted
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement delete_person_query{
+        "delete_person",
+        PSQL(
+            INSERT INTO people.person_deletions (
+                person_id,
+                deleted,
+                deleted_by,
+                deleted_from
+            )
+            VALUES ( $1, $2, $3, $4 )
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement assert_people_exist_query{
+        "assert_people_exist",
+        PSQL(
+            WITH lookfor AS (
+                SELECT UNNEST( $1::BIGINT[] ) AS person_id
+            )
+            SELECT lookfor.person_id
+            FROM
+                lookfor
+                LEFT JOIN people.people_core AS pc
+                    ON pc.person_id = lookfor.person_id
+                LEFT JOIN people.person_deletions AS pd
+                    ON pd.person_id = pc.person_id
+            WHERE
+                   pc.person_id IS     NULL
+                OR pd.person_id IS NOT NULL
+            ;
+        )
+    };
+}
+
+
 namespace
 {
     stickers::bigid write_person_details(
@@ -16,24 +103,14 @@ namespace
         bool                          generate_id
     )
     {
-        auto connection{ stickers::postgres::connect() };
-        pqxx::work transaction{ *connection };
+        stickers::postgres::transaction_scope scope;
+        auto& transaction{ *scope };
         
         if( generate_id )
         {
-            auto result{ transaction.exec_params(
-                PSQL(
-                    INSERT INTO people.people_core (
-                        person_id,
-                        _a_revision
-                    )
-                    VALUES (
-                        DEFAULT,
-                        $1
-                    )
-                    RETURNING person_id
-                    ;
-                ),
+            auto result{ stickers::postgres::exec(
+                transaction,
+                create_person_query,
                 blame.when
             ) };
             result[ 0 ][ "person_id" ].to< stickers::bigid >( person.id );
@@ -41,20 +118,6 @@ namespace
         else
             stickers::assert_people_exist( transaction, { person.id } );
         
-        std::string add_person_revision_query_string{ PSQL(
-            INSERT INTO people.person_revisions (
-                person_id,
-                revised,
-                revised_by,
-                revised_from,
-                person_name,
-                person_user,
-                about
-            )
-            VALUES ( $1, $2, $3, $4, $5, $6, $7 )
-            ;
-        ) };
-        
         if( person.info.has_user() )
         {
             const auto& user_id{ std::get< stickers::bigid >(
@@ -63,8 +126,9 @@ namespace
             
             stickers::assert_users_exist( transaction, { user_id } );
             
-            transaction.exec_params(
-                add_person_revision_query_string,
+            stickers::postgres::exec(
+                transaction,
+                add_person_revision_query,
                 person.id,
                 blame.when,
                 blame.who,
@@ -75,8 +139,9 @@ namespace
             );
         }
         else
-            transaction.exec_params(
-                add_person_revision_query_string,
+            stickers::postgres::exec(
+                transaction,
+                add_person_revision_query,
                 person.id,
                 blame.when,
                 blame.who,
@@ -86,7 +151,7 @@ namespace
                 person.info.about
             );
         
-        transaction.commit();
+        scope.commit();
         return person.id;
     }
 }
@@ -106,26 +171,15 @@ namespace stickers // Person ///////////////////////////////////////////////////
     
     person_info load_person( const bigid& id )
     {
-        auto connection{ postgres::connect() };
-        pqxx::work transaction{ *connection };
+        postgres::transaction_scope scope;
+        auto& transaction{ *scope };
         
-        auto result{ transaction.exec_params(
-            PSQL(
-                SELECT
-                    created,
-                    revised,
-                    person_name,
-                    person_user,
-                    about
-                FROM people.people
-                WHERE
-                    person_id = $1
-                    AND NOT deleted
-                ;
-            ),
+        auto result{ postgres::exec(
+            transaction,
+            load_person_query,
             id
         ) };
-        transaction.commit();
+        scope.commit();
         
         if( result.size() < 1 )
             throw no_such_person{ id };
@@ -161,28 +215,20 @@ namespace stickers // Person ///////////////////////////////////////////////////
     
     void delete_person( const bigid& id, const audit::blame& blame )
     {
-        auto connection{ postgres::connect() };
-        pqxx::work transaction{ *connection };
+        postgres::transaction_scope scope;
+        auto& transaction{ *scope };
         
         assert_people_exist( transaction, { id } );
         
-        auto result{ transaction.exec_params(
-            PSQL(
-                INSERT INTO people.person_deletions (
-                    person_id,
-                    deleted,
-                    deleted_by,
-                    deleted_from
-                )
-                VALUES ( $1, $2, $3, $4 )
-                ;
-            ),
+        auto result{ postgres::exec(
+            transaction,
+            delete_person_query,
             id,
             blame.when,
             blame.who,
             blame.where
         ) };
-        transaction.commit();
+        scope.commit();
     }
 }
 
@@ -202,33 +248,14 @@ namespace stickers // Assertion ////////////////////////////////////////////////
 {
     void _assert_people_exist_impl::exec(
         pqxx::work       & transaction,
-        const std::string& ids_string
+        const std::string& ids_array
     )
     {
-        std::string query_string;
-        
-        ff::fmt(
-            query_string,
-            PSQL(
-                WITH lookfor AS (
-                    SELECT UNNEST( ARRAY[ {0} ] ) AS person_id
-                )
-                SELECT lookfor.person_id
-                FROM
-                    lookfor
-                    LEFT JOIN people.people_core AS pc
-                        ON pc.person_id = lookfor.person_id
-                    LEFT JOIN people.person_deletions AS pd
-                        ON pd.person_id = pc.person_id
-                WHERE
-                       pc.person_id IS     NULL
-                    OR pd.person_id IS NOT NULL
-                ;
-            ),
-            ids_string
-        );
-        
-        auto result{ transaction.exec( query_string ) };
+        auto result{ postgres::exec(
+            transaction,
+            assert_people_exist_query,
+            ids_array
+        ) };
         
         if( result.size() > 0 )
             throw no_such_person{ result[ 0 ][ 0 ].as< bigid >() };
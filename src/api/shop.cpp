@@ -4,10 +4,101 @@
 #include "shop.hpp"
 
 #include "../api/person.hpp"
-#include "../common/formatting.hpp"
 #include "../common/logging.hpp"
 
 
+namespace // Statements ////////////////////////////////////////////////////////
+{
+    const stickers::postgres::statement create_shop_query{
+        "create_shop",
+        PSQL(
+            INSERT INTO shops.shops_core (
+                shop_id,
+                _a_revision
+            )
+            VALUES (
+                DEFAULT,
+                $1
+            )
+            RETURNING shop_id
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement add_shop_revision_query{
+        "add_shop_revision",
+        PSQL(
+            INSERT INTO shops.shop_revisions (
+                shop_id,
+                revised,
+                revised_by,
+                revised_from,
+                shop_name,
+                shop_url,
+                founded,
+                closed,
+                owner_id
+            )
+            VALUES ( $1, $2, $3, $4, $5, $6, $7, $8, $9 )
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement load_shop_query{
+        "load_shop",
+        PSQL(
+            SELECT
+                created,
+                revised,
+                shop_name,
+                shop_url,
+                founded::TIMESTAMPTZ,
+                closed::TIMESTAMPTZ,
+                owner_id
+            FROM shops.shops
+            WHERE
+                shop_id = $1
+                AND NOT deleted
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement delete_shop_query{
+        "delete_shop",
+        PSQL(
+            INSERT INTO shops.shop_deletions (
+                shop_id,
+                deleted,
+                deleted_by,
+                deleted_from
+            )
+            VALUES ( $1, $2, $3, $4 )
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement assert_shops_exist_query{
+        "assert_shops_exist",
+        PSQL(
+            WITH lookfor AS (
+                SELECT UNNEST( $1::BIGINT[] ) AS shop_id
+            )
+            SELECT lookfor.shop_id
+            FROM
+                lookfor
+                LEFT JOIN shops.shops_core AS sc
+                    ON sc.shop_id = lookfor.shop_id
+                LEFT JOIN shops.shop_deletions AS sd
+                    ON sd.shop_id = sc.shop_id
+            WHERE
+                   sc.shop_id IS     NULL
+                OR sd.shop_id IS NOT NULL
+            ;
+        )
+    };
+}
+
+
 namespace
 {
     stickers::bigid write_shop_details(
@@ -16,24 +107,14 @@ namespace
         bool                          generate_id
     )
     {
-        auto connection{ stickers::postgres::connect() };
-        pqxx::work transaction{ *connection };
+        stickers::postgres::transaction_scope scope;
+        auto& transaction{ *scope };
         
         if( generate_id )
         {
-            auto result{ transaction.exec_params(
-                PSQL(
-                    INSERT INTO shops.shops_core (
-                        shop_id,
-                        _a_revision
-                    )
-                    VALUES (
-                        DEFAULT,
-                        $1
-                    )
-                    RETURNING shop_id
-                    ;
-                ),
+            auto result{ stickers::postgres::exec(
+                transaction,
+                create_shop_query,
                 blame.when
             ) };
             result[ 0 ][ "shop_id" ].to< stickers::bigid >( shop.id );
@@ -46,22 +127,9 @@ namespace
             { shop.info.owner_person_id }
         );
         
-        transaction.exec_params(
-            PSQL(
-                INSERT INTO shops.shop_revisions (
-                    shop_id,
-                    revised,
-                    revised_by,
-                    revised_from,
-                    shop_name,
-                    shop_url,
-                    founded,
-                    closed,
-                    owner_id
-                )
-                VALUES ( $1, $2, $3, $4, $5, $6, $7, $8, $9 )
-                ;
-            ),
+        stickers::postgres::exec(
+            transaction,
+            add_shop_revision_query,
             shop.id,
             blame.when,
             blame.who,
@@ -73,7 +141,7 @@ namespace
             shop.info.owner_person_id
         );
         
-        transaction.commit();
+        scope.commit();
         return shop.id;
     }
 }
@@ -93,28 +161,15 @@ namespace stickers // Person ///////////////////////////////////////////////////
     
     shop_info load_shop( const bigid& id )
     {
-        auto connection{ postgres::connect() };
-        pqxx::work transaction{ *connection };
+        postgres::transaction_scope scope;
+        auto& transaction{ *scope };
         
-        auto result{ transaction.exec_params(
-            PSQL(
-                SELECT
-                    created,
-                    revised,
-                    shop_name,
-                    shop_url,
-                    founded::TIMESTAMPTZ,
-                    closed::TIMESTAMPTZ,
-                    owner_id
-                FROM shops.shops
-                WHERE
-                    shop_id = $1
-                    AND NOT deleted
-                ;
-            ),
+        auto result{ postgres::exec(
+            transaction,
+            load_shop_query,
             id
         ) };
-        transaction.commit();
+        scope.commit();
         
         if( result.size() < 1 )
             throw no_such_shop{ id };
@@ -148,28 +203,20 @@ namespace stickers // Person ///////////////////////////////////////////////////
     
     void delete_shop( const bigid& id, const audit::blame& blame )
     {
-        auto connection{ postgres::connect() };
-        pqxx::work transaction{ *connection };
+        postgres::transaction_scope scope;
+        auto& transaction{ *scope };
         
         assert_shops_exist( transaction, { id } );
         
-        auto result{ transaction.exec_params(
-            PSQL(
-                INSERT INTO shops.shop_deletions (
-                    shop_id,
-                    deleted,
-                    deleted_by,
-                    deleted_from
-                )
-                VALUES ( $1, $2, $3, $4 )
-                ;
-            ),
+        auto result{ postgres::exec(
+            transaction,
+            delete_shop_query,
             id,
             blame.when,
             blame.who,
             blame.where
         ) };
-        transaction.commit();
+        scope.commit();
     }
 }
 
@@ -189,33 +236,14 @@ namespace stickers // Assertion ////////////////////////////////////////////////
 {
     void _assert_shops_exist_impl::exec(
         pqxx::work       & transaction,
-        const std::string& ids_string
+        const std::string& ids_array
     )
     {
-        std::string query_string;
-        
-        ff::fmt(
-            query_string,
-            PSQL(
-                WITH lookfor AS (
-                    SELECT UNNEST( ARRAY[ {0} ] ) AS shop_id
-                )
-                SELECT lookfor.shop_id
-                FROM
-                    lookfor
-                    LEFT JOIN shops.shops_core AS sc
-                        ON sc.shop_id = lookfor.shop_id
-                    LEFT JOIN shops.shop_deletions AS sd
-                        ON sd.shop_id = sc.shop_id
-                WHERE
-                       sc.shop_id IS     NULL
-                    OR sd.shop_id IS NOT NULL
-                ;
-            ),
-            ids_string
-        );
-        
-        auto result{ transaction.exec( query_string ) };
+        auto result{ postgres::exec(
+            transaction,
+            assert_shops_exist_query,
+            ids_array
+        ) };
         
         if( result.size() > 0 )
             throw no_such_shop{ result[ 0 ][ 0 ].as< bigid >() };
@@ -59,7 +59,7 @@ namespace stickers
     {
         _assert_shops_exist_impl::exec(
             transaction,
-            postgres::format_variable_list( transaction, ids )
+            postgres::format_array_parameter( ids )
         );
     }
     
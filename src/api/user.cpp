@@ -7,6 +7,7 @@
 #include "../common/config.hpp"
 #include "../common/formatting.hpp"
 #include "../common/logging.hpp"
+#include "../common/password_hashing.hpp"
 #include "../common/postgres.hpp"
 #include "../common/redis.hpp"
 #include "../common/timestamp.hpp"
@@ -14,17 +15,154 @@
 #include <fstream>
 
 
+namespace // Statements ////////////////////////////////////////////////////////
+{
+    const stickers::postgres::statement create_user_query{
+        "create_user",
+        PSQL(
+            INSERT INTO users.user_core (
+                user_id,
+                _a_revision,
+                _email_current,
+                password
+            )
+            VALUES (
+                DEFAULT,
+                $1,
+                TRUE,
+                ROW( $2, $3, $4, $5 )
+            )
+            RETURNING user_id
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement load_current_email_query{
+        "load_current_email",
+        PSQL(
+            SELECT email
+            FROM users.user_emails
+            WHERE
+                user_id = $1
+                AND current
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement add_user_revision_query{
+        "add_user_revision",
+        PSQL(
+            INSERT INTO users.user_revisions (
+                user_id,
+                revised,
+                revised_by,
+                revised_from,
+                display_name,
+                real_name,
+                avatar_hash
+            )
+            VALUES ( $1, $2, $3, $4, $5, $6, $7 )
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement add_user_email_query{
+        "add_user_email",
+        PSQL(
+            INSERT INTO users.user_emails
+            VALUES ( $1, $2, $3, $4, $5, $6 )
+            ;
+        )
+    };
+    
+    // Users are looked up the same way by either ID or email
+    std::string load_user_by( const std::string& field )
+    {
+        std::string query_string;
+        
+        ff::fmt(
+            query_string,
+            PSQL(
+                SELECT
+                    user_id,
+                    ( password ).type   AS password_type,
+                    ( password ).hash   AS password_hash,
+                    ( password ).salt   AS password_salt,
+                    ( password ).factor AS password_factor,
+                    created,
+                    revised,
+                    display_name,
+                    real_name,
+                    avatar_hash,
+                    email
+                FROM users.users
+                WHERE {0} = $1
+                AND NOT deleted
+                ;
+            ),
+            field
+        );
+        
+        return query_string;
+    }
+    
+    const stickers::postgres::statement load_user_by_id_query{
+        "load_user_by_id",
+        load_user_by( "user_id" )
+    };
+    
+    const stickers::postgres::statement load_user_by_email_query{
+        "load_user_by_email",
+        load_user_by( "email" )
+    };
+    
+    const stickers::postgres::statement delete_user_query{
+        "delete_user",
+        PSQL(
+            INSERT INTO users.user_deletions (
+                user_id,
+                deleted,
+                deleted_by,
+                deleted_from
+            ) VALUES ( $1, $2, $3, $4 )
+            ON CONFLICT DO NOTHING
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement assert_users_exist_query{
+        "assert_users_exist",
+        PSQL(
+            WITH lookfor AS (
+                SELECT UNNEST( $1::BIGINT[] ) AS user_id
+            )
+            SELECT lookfor.user_id
+            FROM
+                lookfor
+                LEFT JOIN users.users_core AS uc
+                    ON uc.user_id = lookfor.user_id
+                LEFT JOIN users.user_deletions AS ud
+                    ON ud.user_id = uc.user_id
+            WHERE
+                   uc.user_id IS     NULL
+                OR ud.user_id IS NOT NULL
+            ;
+        )
+    };
+}
+
+
 namespace
 {
     stickers::bigid write_user_details(
-        std::unique_ptr< pqxx::connection >& connection,
-        stickers::user                     & user,
-        const stickers::audit::blame       & blame,
-        bool                                 generate_id,
-        bool                                 signup = false
+        stickers::user              & user,
+        const stickers::audit::blame& blame,
+        bool                          generate_id,
+        bool                          signup = false
     )
     {
-        pqxx::work transaction{ *connection };
+        stickers::postgres::transaction_scope scope;
+        auto& transaction{ *scope };
         std::string current_email;
         
         if( user.info.avatar_hash )
@@ -35,23 +173,9 @@ namespace
         
         if( generate_id )
         {
-            auto result{ transaction.exec_params(
-                PSQL(
-                    INSERT INTO users.user_core (
-                        user_id,
-                        _a_revision,
-                        _email_current,
-                        password
-                    )
-                    VALUES (
-                        DEFAULT,
-                        $1,
-                        TRUE,
-                        ROW( $2, $3, $4, $5 )
-                    )
-                    RETURNING user_id
-                    ;
-                ),
+            auto result{ stickers::postgres::exec(
+                transaction,
+                create_user_query,
                 blame.when,
                 user.info.password.type(),
                 pqxx::binarystring( user.info.password.hash() ),
@@ -62,15 +186,9 @@ namespace
         }
         else
         {
-            auto result{ transaction.exec_params(
-                PSQL(
-                    SELECT email
-                    FROM users.user_emails
-                    WHERE
-                        user_id = $1
-                        AND current
-                    ;
-                ),
+            auto result{ stickers::postgres::exec(
+                transaction,
+                load_current_email_query,
                 user.id
             ) };
             if( result.size() >= 1 )
@@ -78,21 +196,9 @@ namespace
         }
         
         // TODO: update user password
-        std::string add_user_revision{ PSQL(
-            INSERT INTO users.user_revisions (
-                user_id,
-                revised,
-                revised_by,
-                revised_from,
-                display_name,
-                real_name,
-                avatar_hash
-            )
-            VALUES ( $1, $2, $3, $4, $5, $6, $7 )
-            ;
-        ) };
-        transaction.exec_params(
-            add_user_revision,
+        stickers::postgres::exec(
+            transaction,
+            add_user_revision_query,
             user.id,
             blame.when,
             ( signup ? user.id : blame.who ),
@@ -105,12 +211,9 @@ namespace
         if( user.info.email != current_email )
         {
             // TODO: figure out a way to have an "invalid" signup email
-            transaction.exec_params(
-                PSQL(
-                    INSERT INTO users.user_emails
-                    VALUES ( $1, $2, $3, $4, $5, $6 )
-                    ;
-                ),
+            stickers::postgres::exec(
+                transaction,
+                add_user_email_query,
                 user.id,
                 user.info.email,
                 signup,
@@ -121,50 +224,10 @@ namespace
             stickers::send_validation_email( user.id );
         }
         
-        transaction.commit();
+        scope.commit();
         return user.id;
     }
     
-    template< typename T > pqxx::result query_user_records_by(
-        pqxx::work& transaction,
-        const std::string& field,
-        const T& iden
-    )
-    {
-        std::string query_string;
-        
-        ff::fmt(
-            query_string,
-            PSQL(
-                SELECT
-                    user_id,
-                    ( password ).type   AS password_type,
-                    ( password ).hash   AS password_hash,
-                    ( password ).salt   AS password_salt,
-                    ( password ).factor AS password_factor,
-                    created,
-                    revised,
-                    display_name,
-                    real_name,
-                    avatar_hash,
-                    email
-                FROM users.users
-                WHERE {0} = $1
-                AND NOT deleted
-                ;
-            ),
-            field
-        );
-        
-        pqxx::result result{ transaction.exec_params(
-            query_string,
-            iden
-        ) };
-        transaction.commit();
-        
-        return result;
-    }
-    
     stickers::user_info compile_user_info_from_row( const pqxx::row& row )
     {
         stickers::password pw;
@@ -439,8 +502,6 @@ namespace stickers // User management //////////////////////////////////////////
             "creating new user"
         );
         
-        auto connection{ postgres::connect() };
-        
         user new_user{
             blame.who,
             info
@@ -448,8 +509,15 @@ namespace stickers // User management //////////////////////////////////////////
         
         if( new_user.info.password.type() == password_type::RAW )
         {
-            new_user.info.password = hash_password(
-                new_user.info.password.value< std::string >()
+            // No account to count against yet
+            run_password_hash(
+                [ &new_user ]{
+                    new_user.info.password = hash_password(
+                        new_user.info.password.value< std::string >()
+                    );
+                },
+                blame.where,
+                ""
             );
         }
         else if( new_user.info.password.type() != password_type::INVALID )
@@ -459,7 +527,6 @@ namespace stickers // User management //////////////////////////////////////////
             );
         
         new_user.id = write_user_details(
-            connection,
             new_user,
             blame,
             true,
@@ -477,12 +544,12 @@ namespace stickers // User management //////////////////////////////////////////
     
     user_info load_user( const bigid& id )
     {
-        auto connection{ postgres::connect() };
-        pqxx::work transaction{ *connection };
+        postgres::transaction_scope scope;
+        auto& transaction{ *scope };
         
-        auto result{ query_user_records_by(
+        auto result{ postgres::exec(
             transaction,
-            "user_id",
+            load_user_by_id_query,
             id
         ) };
         
@@ -494,17 +561,20 @@ namespace stickers // User management //////////////////////////////////////////
     
     user_info update_user( const user& u, const audit::blame& blame )
     {
-        auto connection{ postgres::connect() };
-        
         user updated_user{ u };
         
         if( updated_user.info.password.type() == password_type::RAW )
-            updated_user.info.password = hash_password(
-                updated_user.info.password.value< std::string >()
+            run_password_hash(
+                [ &updated_user ]{
+                    updated_user.info.password = hash_password(
+                        updated_user.info.password.value< std::string >()
+                    );
+                },
+                blame.where,
+                static_cast< std::string >( updated_user.id )
             );
         
         write_user_details(
-            connection,
             updated_user,
             blame,
             false
@@ -515,36 +585,28 @@ namespace stickers // User management //////////////////////////////////////////
     
     void delete_user( const bigid& id, const audit::blame& blame )
     {
-        auto connection{ postgres::connect() };
-        pqxx::work transaction{ *connection };
+        postgres::transaction_scope scope;
+        auto& transaction{ *scope };
         
-        transaction.exec_params(
-            PSQL(
-                INSERT INTO users.user_deletions (
-                    user_id,
-                    deleted,
-                    deleted_by,
-                    deleted_from
-                ) VALUES ( $1, $2, $3, $4 )
-                ON CONFLICT DO NOTHING
-                ;
-            ),
+        postgres::exec(
+            transaction,
+            delete_user_query,
             id,
             blame.when,
             blame.who,
             blame.where
         );
-        transaction.commit();
+        scope.commit();
     }
     
     user load_user_by_email( const std::string& email )
     {
-        auto connection{ postgres::connect() };
-        pqxx::work transaction{ *connection };
+        postgres::transaction_scope scope;
+        auto& transaction{ *scope };
         
-        auto result{ query_user_records_by(
+        auto result{ postgres::exec(
             transaction,
-            "email",
+            load_user_by_email_query,
             email
         ) };
         
@@ -604,33 +666,14 @@ namespace stickers // Assertions ///////////////////////////////////////////////
 {
     void _assert_users_exist_impl::exec(
         pqxx::work       & transaction,
-        const std::string& ids_string
+        const std::string& ids_array
     )
     {
-        std::string query_string;
-        
-        ff::fmt(
-            query_string,
-            PSQL(
-                WITH lookfor AS (
-                    SELECT UNNEST( ARRAY[ {0} ] ) AS user_id
-                )
-                SELECT lookfor.user_id
-                FROM
-                    lookfor
-                    LEFT JOIN users.users_core AS uc
-                        ON uc.user_id = lookfor.user_id
-                    LEFT JOIN users.user_deletions AS ud
-                        ON ud.user_id = uc.user_id
-                WHERE
-                       uc.user_id IS     NULL
-                    OR ud.user_id IS NOT NULL
-                ;
-            ),
-            ids_string
-        );
-        
-        auto result{ transaction.exec( query_string ) };
+        auto result{ postgres::exec(
+            transaction,
+            assert_users_exist_query,
+            ids_array
+        ) };
         
         if( result.size() > 0 )
             throw no_such_user::by_id(
@@ -110,6 +110,8 @@ namespace stickers // User management //////////////////////////////////////////
         user_info info;
     };
     
+    // `create_user()` & `update_user()` hash a raw password on the password
+    // hashing pool, so must not be called inside a `transaction_scope`
     user      create_user( const user_info&, const audit::blame&, bool signup = true );
     user_info   load_user( const bigid    &                      );
     user_info update_user( const user     &, const audit::blame& );
@@ -140,7 +142,7 @@ namespace stickers // User management //////////////////////////////////////////
     {
         _assert_users_exist_impl::exec(
             transaction,
-            postgres::format_variable_list( transaction, hashes )
+            postgres::format_array_parameter( hashes )
         );
     }
 }
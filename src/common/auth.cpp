@@ -4,13 +4,427 @@
 #include "auth.hpp"
 
 #include "logging.hpp"
+#include "lru_cache.hpp"
 #include "postgres.hpp"
+#include "request_timing.hpp"
 #include "string_utils.hpp"
 #include "../api/user.hpp"  // stickers::no_such_user
 #include "../common/config.hpp"
 
-#include <algorithm>    // std::set_difference()
-#include <iterator>     // std::inserter
+#include <atomic>
+#include <chrono>
+#include <functional>   // std::hash<>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+
+
+namespace // Statements ////////////////////////////////////////////////////////
+{
+    const stickers::postgres::statement load_user_role_query{
+        "load_user_role",
+        PSQL(
+            SELECT user_role_id AS role_id
+            FROM users.users
+            WHERE
+                user_id = $1
+                AND NOT deleted
+            ;
+        )
+    };
+    
+    const stickers::postgres::statement load_role_permissions_query{
+        "load_role_permissions",
+        PSQL(
+            SELECT p.permission AS permission
+            FROM
+                permissions.role_permissions AS rp
+                JOIN permissions.permissions AS p
+                    ON rp.permission_id = p.permission_id
+            WHERE rp.role_id = $1
+            ;
+        )
+    };
+}
+
+
+namespace // Permission caches /////////////////////////////////////////////////
+{
+    // Kept in its text form so this doesn't depend on the column's type
+    using role_id_type = std::string;
+    
+    stickers::sharded_lru_cache<
+        long long,
+        std::optional< role_id_type >
+    > user_roles;
+    stickers::sharded_lru_cache<
+        role_id_type,
+        stickers::permissions_type
+    > role_permissions;
+    
+    // The caches are only used while the invalidation listener is connected,
+    // as changes made while it isn't would be missed; the generation is bumped
+    // on every invalidation so a load that raced one isn't cached
+    std::atomic< bool               > invalidation_listening{ false };
+    std::atomic< unsigned long long > invalidation_generation{ 0 };
+    
+    // Stops the caches being used & drops everything in them; called whenever
+    // the listener may have missed a notification
+    void flush_permission_caches()
+    {
+        invalidation_listening = false;
+        ++invalidation_generation;
+        user_roles.clear();
+        role_permissions.clear();
+    }
+    
+    // Caches a value loaded while the generation was `generation`, unless an
+    // invalidation has happened since; checked again after inserting, as one
+    // that ran in between would have found nothing to erase
+    template< typename Cache, typename Key, typename Value > void cache_loaded(
+        Cache            & cache,
+        const Key        & key,
+        const Value      & value,
+        unsigned long long generation
+    )
+    {
+        if( generation != invalidation_generation.load() )
+            return;
+        
+        cache.insert(
+            key,
+            value,
+            stickers::current_settings().auth.permission_cache_size
+        );
+        
+        if( generation != invalidation_generation.load() )
+            cache.erase( key );
+    }
+    
+    // Permissions only get bits when added to `known_permissions`, so one added
+    // to the database alone is ignored; say so, but only once per name as this
+    // is seen on every uncached load
+    void warn_unknown_permission( const std::string& name )
+    {
+        static std::mutex                        warned_mutex;
+        static std::unordered_set< std::string > warned;
+        
+        {
+            std::lock_guard< std::mutex > guard{ warned_mutex };
+            if( !warned.insert( name ).second )
+                return;
+        }
+        
+        STICKERS_LOG(
+            stickers::log_level::WARNING,
+            "ignoring permission \"",
+            stickers::log_sanitize( name ),
+            "\" from the database as it isn't known to this server"
+        );
+    }
+    
+    std::optional< role_id_type > load_user_role( stickers::bigid user_id )
+    {
+        auto use_cache { invalidation_listening.load() };
+        auto generation{ invalidation_generation.load() };
+        
+        if( use_cache )
+            if( auto cached{
+                user_roles.find( static_cast< long long >( user_id ) )
+            } )
+                return *cached;
+        
+        stickers::postgres::transaction_scope scope;
+        auto& transaction{ *scope };
+        
+        auto result{ stickers::postgres::exec(
+            transaction,
+            load_user_role_query,
+            user_id
+        ) };
+        
+        // Also serves as the check that the user exists
+        if( result.size() < 1 )
+            throw stickers::no_such_user::by_id( user_id, "loading role" );
+        
+        scope.commit();
+        
+        std::optional< role_id_type > role;
+        if( !result[ 0 ][ "role_id" ].is_null() )
+            role = result[ 0 ][ "role_id" ].as< std::string >();
+        
+        if( use_cache )
+            cache_loaded(
+                user_roles,
+                static_cast< long long >( user_id ),
+                role,
+                generation
+            );
+        
+        return role;
+    }
+    
+    stickers::permissions_type load_role_permissions( const role_id_type& role )
+    {
+        auto use_cache { invalidation_listening.load() };
+        auto generation{ invalidation_generation.load() };
+        
+        if( use_cache )
+            if( auto cached{ role_permissions.find( role ) } )
+                return *cached;
+        
+        stickers::postgres::transaction_scope scope;
+        auto& transaction{ *scope };
+        
+        auto result{ stickers::postgres::exec(
+            transaction,
+            load_role_permissions_query,
+            role
+        ) };
+        
+        scope.commit();
+        
+        stickers::permissions_type permissions;
+        for( const auto& row : result )
+        {
+            auto name{ row[ "permission" ].as< std::string >() };
+            auto permission{ stickers::named_permission( name ) };
+            if( permission.none() )
+                warn_unknown_permission( name );
+            permissions |= permission;
+        }
+        
+        if( use_cache )
+            cache_loaded( role_permissions, role, permissions, generation );
+        
+        return permissions;
+    }
+    
+    // An empty payload invalidates every entry
+    template< typename Cache, typename Key > void invalidate(
+        Cache             & cache,
+        const std::string & payload,
+        Key              ( *parse_key )( const std::string& )
+    )
+    {
+        ++invalidation_generation;
+        
+        if( payload.empty() )
+            cache.clear();
+        else
+            try
+            {
+                cache.erase( parse_key( payload ) );
+            }
+            catch( const std::exception& )
+            {
+                STICKERS_LOG(
+                    stickers::log_level::WARNING,
+                    "unusable permission cache invalidation payload \"",
+                    stickers::log_sanitize( payload ),
+                    "\", clearing cache instead"
+                );
+                cache.clear();
+            }
+    }
+    
+    class invalidation_receiver : public pqxx::notification_receiver
+    {
+    public:
+        invalidation_receiver(
+            pqxx::connection_base& connection,
+            const std::string    & channel,
+            void ( *invalidate )( const std::string& )
+        ) :
+            pqxx::notification_receiver{ connection, channel },
+            invalidate{ invalidate }
+        {}
+        
+        void operator()( const std::string& payload, int ) override
+        {
+            invalidate( payload );
+        }
+    
+    protected:
+        void ( *invalidate )( const std::string& );
+    };
+    
+    bool same_database(
+        const stickers::settings::database_settings& a,
+        const stickers::settings::database_settings& b
+    )
+    {
+        return (
+               a.host   == b.host
+            && a.port   == b.port
+            && a.user   == b.user
+            && a.pass   == b.pass
+            && a.dbname == b.dbname
+        );
+    }
+    
+    void listen_for_invalidations()
+    {
+        while( true )
+        {
+            // With the caches off there's nothing to keep in sync, so don't
+            // hold a connection open; just watch for a reload turning them on
+            stickers::refresh_config();
+            if( stickers::current_settings().auth.permission_cache_size == 0 )
+            {
+                std::this_thread::sleep_for( std::chrono::seconds{ 5 } );
+                continue;
+            }
+            
+            try
+            {
+                // Copied, as the snapshot is refreshed while this is in use
+                auto db_settings{ stickers::current_settings().database };
+                auto connection{ stickers::postgres::connect(
+                    db_settings.host,
+                    db_settings.port,
+                    db_settings.user,
+                    db_settings.pass,
+                    db_settings.dbname
+                ) };
+                
+                invalidation_receiver user_receiver{
+                    *connection,
+                    "user_role_changed",
+                    []( const std::string& payload ){
+                        invalidate(
+                            user_roles,
+                            payload,
+                            +[]( const std::string& key ){
+                                return std::stoll( key );
+                            }
+                        );
+                    }
+                };
+                invalidation_receiver role_receiver{
+                    *connection,
+                    "role_permissions_changed",
+                    []( const std::string& payload ){
+                        invalidate(
+                            role_permissions,
+                            payload,
+                            +[]( const std::string& key ){ return key; }
+                        );
+                    }
+                };
+                
+                // Anything cached before now may have missed a notification
+                flush_permission_caches();
+                invalidation_listening = true;
+                
+                STICKERS_LOG(
+                    stickers::log_level::INFO,
+                    "listening for permission changes"
+                );
+                
+                // A quiet connection is checked every few seconds so one
+                // that's silently dropped is noticed quickly; the caches
+                // aren't used while a check is in flight, as that's when a
+                // dead connection would be waited on
+                while( true )
+                {
+                    // Pick up any reloaded config, as request workers do
+                    // between requests; one that moves the database means
+                    // listening there instead, & one turning the caches off
+                    // means not listening at all
+                    stickers::refresh_config();
+                    auto& settings{ stickers::current_settings() };
+                    if(
+                        !same_database( db_settings, settings.database )
+                        || settings.auth.permission_cache_size == 0
+                    )
+                        break;
+                    
+                    if( connection -> await_notification( 5, 0 ) )
+                        continue;
+                    
+                    invalidation_listening = false;
+                    pqxx::nontransaction{ *connection }.exec( "SELECT 1" );
+                    // Anything sent since the last check has been delivered
+                    // by now, so the caches are as current as the connection
+                    connection -> get_notifs();
+                    invalidation_listening = true;
+                }
+                
+                flush_permission_caches();
+                
+                STICKERS_LOG(
+                    stickers::log_level::INFO,
+                    "database or permission cache settings changed, "
+                    "restarting permission change listener"
+                );
+                continue;
+            }
+            catch( const std::exception& e )
+            {
+                flush_permission_caches();
+                
+                STICKERS_LOG(
+                    stickers::log_level::WARNING,
+                    "permission cache invalidation listener failed, caches "
+                    "disabled until it reconnects: ",
+                    e.what()
+                );
+            }
+            
+            std::this_thread::sleep_for( std::chrono::seconds{ 5 } );
+        }
+    }
+}
+
+
+namespace // Verified token cache //////////////////////////////////////////////
+{
+    struct verified_token
+    {
+        stickers::auth_info                  info;
+        std::optional< stickers::timestamp > nbf;
+        std::optional< stickers::timestamp > exp;
+        std::string                          kid;
+        std::string                          signing_key;
+    };
+    
+    // Only the signature segment is hashed as it's short & effectively random,
+    // but entries are still compared on the whole token
+    struct token_signature_hash
+    {
+        std::size_t operator()( const std::string& token ) const
+        {
+            std::string_view view{ token };
+            return std::hash< std::string_view >{}(
+                view.substr( view.rfind( '.' ) + 1 )
+            );
+        }
+    };
+    
+    stickers::sharded_lru_cache<
+        std::string,
+        verified_token,
+        token_signature_hash
+    > verified_tokens;
+    
+    // A cached token is only as good as the key that signed it, so rotating
+    // a key out of the config also invalidates its cached tokens
+    bool still_valid( const verified_token& token )
+    {
+        auto& signing_keys{ stickers::current_settings().auth.jwt_keys };
+        auto found_key{ signing_keys.find( token.kid ) };
+        
+        return (
+            found_key != signing_keys.end()
+            && found_key -> second == token.signing_key
+            && !( token.nbf && *token.nbf >  stickers::now() )
+            && !( token.exp && *token.exp <= stickers::now() )
+        );
+    }
+}
 
 
 namespace
@@ -20,6 +434,17 @@ namespace
         stickers::auth_info& info
     )
     {
+        // Clients send the same token with every request, so skip parsing &
+        // verifying it again if it's been seen recently
+        auto cached{ verified_tokens.find( token_string ) };
+        if( cached && still_valid( *cached ) )
+        {
+            info = std::move( cached -> info );
+            return true;
+        }
+        else if( cached )
+            verified_tokens.erase( token_string );
+        
         try
         {
             auto auth_jwt{ stickers::jwt::parse( token_string ) };
@@ -37,8 +462,10 @@ namespace
                 found_permissions != auth_jwt.claims.end()
                 && found_permissions.value().is_array()
             )
-                for( const auto& permission : found_permissions.value() )
-                    permissions.insert( permission.get< std::string >() );
+                for( const auto& name : found_permissions.value() )
+                    permissions |= stickers::named_permission(
+                        name.get< std::string >()
+                    );
             else
                 throw stickers::authentication_error{
                     "missing required claim \"permissions\""
@@ -67,6 +494,21 @@ namespace
                     user_id,
                     permissions
                 };
+                
+                // `jwt::parse()` has already checked the key ID is known
+                verified_tokens.insert(
+                    token_string,
+                    {
+                        info,
+                        auth_jwt.nbf,
+                        auth_jwt.exp,
+                        *auth_jwt.kid,
+                        stickers::current_settings().auth.jwt_keys.at(
+                            *auth_jwt.kid
+                        )
+                    },
+                    stickers::current_settings().auth.token_cache_size
+                );
                 return true;
             }
             else
@@ -101,10 +543,35 @@ namespace
 }
 
 
+namespace stickers // Permissions /////////////////////////////////////////////
+{
+    permissions_type named_permission( std::string_view name )
+    {
+        for( std::size_t bit = 0; bit < known_permissions.size(); ++bit )
+            if( known_permissions[ bit ] == name )
+                return permissions_type{}.set( bit );
+        return {};
+    }
+    
+    std::vector< std::string > permission_names(
+        const permissions_type& permissions
+    )
+    {
+        std::vector< std::string > names;
+        for( std::size_t bit = 0; bit < known_permissions.size(); ++bit )
+            if( permissions.test( bit ) )
+                names.emplace_back( known_permissions[ bit ] );
+        return names;
+    }
+}
+
+
 namespace stickers
 {
     auth_info authenticate( const show::request& request )
     {
+        phase_timer timer{ request_phase::AUTHENTICATION };
+        
         bool header_found{ false };
         bool   auth_found{ false };
         
@@ -135,8 +602,7 @@ namespace stickers
         {
             header_found = true;
             std::string cookie_begin{
-                config()[ "auth" ][ "token_cookie_name" ].get< std::string >()
-                + "="
+                current_settings().auth.token_cookie_name + "="
             };
             
             for( const auto& header_value : cookie_headers -> second )
@@ -159,7 +625,7 @@ namespace stickers
             };
         else if( !auth_found )
             throw authentication_error{
-                "no usable authentication tokens found" 
+                "no usable authentication tokens found"
             };
         else
             return info;
@@ -172,20 +638,16 @@ namespace stickers
     {
         auto permissions{ get_user_permissions( user_id ) };
         
-        auto token_lifetime = std::chrono::hours{
-            config()[ "auth" ][ "token_lifetime_hours" ].get< int >()
-        };
-        
         jwt token{
             .iat = now(),
             .nbf = now(),
-            .exp = now() + token_lifetime,
+            .exp = now() + current_settings().auth.token_lifetime,
             .claims = {
                 {
                     "user_id",
                     static_cast< std::string >( user_id )
                 },
-                { "permissions", permissions },
+                { "permissions", permission_names( permissions ) },
                 { "blame", {
                     { "who"  , static_cast< std::string >( blame.who   ) },
                     { "what" ,                             blame.what    },
@@ -222,40 +684,16 @@ namespace stickers
     
     permissions_type get_user_permissions( bigid user_id )
     {
-        auto connection{ postgres::connect() };
-        pqxx::work transaction{ *connection };
-        
-        pqxx::result result{ transaction.exec_params(
-            PSQL(
-                SELECT p.permission AS permission
-                FROM
-                    users.users AS u
-                    JOIN permissions.role_permissions AS rp
-                        ON u.user_role_id = rp.role_id
-                    JOIN permissions.permissions AS p
-                        ON rp.permission_id = p.permission_id
-                WHERE u.user_id = $1
-                ;
-            ),
-            user_id
-        ) };
-        transaction.commit();
-        
-        if( result.size() < 1 )
-        {
-            // Assert that the user even exists; if so, continue to return an
-            // empty set of permissions; if not, throw `no_such_user`
-            // FIXME: This (possibly) requires an extra database access for e.g.
-            // banned users, who we most likely _don't_ want causing extra load
-            auto user_info = load_user( user_id );
-        }
-        
-        permissions_type permissions;
-        
-        for( const auto& row : result )
-            permissions.insert( row[ "permission" ].as< std::string >() );
-        
-        return permissions;
+        auto role{ load_user_role( user_id ) };
+        if( role )
+            return load_role_permissions( *role );
+        else
+            return {};
+    }
+    
+    void listen_for_permission_changes()
+    {
+        std::thread{ listen_for_invalidations }.detach();
     }
     
     void permissions_assert_any(
@@ -263,22 +701,11 @@ namespace stickers
         const permissions_type& expect
     )
     {
-        std::set< std::string > difference;
-        
-        std::set_difference(
-            expect.begin(),
-            expect.end(),
-            got.begin(),
-            got.end(),
-            std::inserter( difference, difference.begin() )
-        );
-        
-        if( difference.size() == expect.size() )
+        if( ( got & expect ).none() )
             throw authorization_error{
-                "missing one of these permissions: \"" + join(
-                    difference,
-                    std::string{ "\", \"" }
-                ) + "\""
+                "missing one of these permissions: \""
+                + join( permission_names( expect ), "\", \"" )
+                + "\""
             };
     }
     
@@ -287,22 +714,11 @@ namespace stickers
         const permissions_type& expect
     )
     {
-        std::set< std::string > difference;
-        
-        std::set_difference(
-            expect.begin(),
-            expect.end(),
-            got.begin(),
-            got.end(),
-            std::inserter( difference, difference.begin() )
-        );
-        
-        if( difference.size() )
+        if( ( got & expect ) != expect )
             throw authorization_error{
-                "missing permissions: \"" + join(
-                    difference,
-                    std::string{ "\", \"" }
-                ) + "\""
+                "missing permissions: \""
+                + join( permission_names( expect & ~got ), "\", \"" )
+                + "\""
             };
     }
 }
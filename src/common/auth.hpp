@@ -9,14 +9,83 @@
 
 #include <show.hpp>
 
+#include <array>
+#include <bitset>
+#include <cstddef>      // std::size_t
 #include <exception>
-#include <set>
+#include <stdexcept>    // std::invalid_argument
 #include <string>
+#include <string_view>
+#include <vector>
 
 
 namespace stickers
 {
-    using permissions_type = std::set< std::string >;
+    constexpr std::size_t max_permissions{ 64 };
+    
+    // One bit per permission; names are only needed to read permissions from
+    // the database & tokens, and to write them back out for tokens & errors
+    using permissions_type = std::bitset< max_permissions >;
+    
+    // Permissions checked by the API; a permission's bit is its index here,
+    // fixed at compile time
+    constexpr std::array< std::string_view, 8 > known_permissions{ {
+        "create_user",
+        "delete_any_user",
+        "delete_own_user",
+        "edit_any_user",
+        "edit_own_user",
+        "edit_public_pages",
+        "log_in",
+        "view_metrics"
+    } };
+    
+    static_assert(
+        known_permissions.size() <= max_permissions,
+        "more known permissions than bits in permissions_type"
+    );
+    
+    // Only usable in constant expressions, where an unknown name won't compile
+    constexpr permissions_type known_permission( std::string_view name )
+    {
+        for( std::size_t bit = 0; bit < known_permissions.size(); ++bit )
+            if( known_permissions[ bit ] == name )
+                return permissions_type{ 1ull << bit };
+        throw std::invalid_argument{ "not a known permission" };
+    }
+    
+    // Any name without a bit, whether from the database or a token, gives an
+    // empty set
+    permissions_type named_permission( std::string_view );
+    std::vector< std::string > permission_names( const permissions_type& );
+    
+    namespace permission
+    {
+        inline constexpr permissions_type create_user{
+            known_permission( "create_user" )
+        };
+        inline constexpr permissions_type delete_any_user{
+            known_permission( "delete_any_user" )
+        };
+        inline constexpr permissions_type delete_own_user{
+            known_permission( "delete_own_user" )
+        };
+        inline constexpr permissions_type edit_any_user{
+            known_permission( "edit_any_user" )
+        };
+        inline constexpr permissions_type edit_own_user{
+            known_permission( "edit_own_user" )
+        };
+        inline constexpr permissions_type edit_public_pages{
+            known_permission( "edit_public_pages" )
+        };
+        inline constexpr permissions_type log_in{
+            known_permission( "log_in" )
+        };
+        inline constexpr permissions_type view_metrics{
+            known_permission( "view_metrics" )
+        };
+    }
     
     struct auth_info
     {
@@ -27,8 +96,18 @@ namespace stickers
     auth_info authenticate( const show::request& );
     jwt generate_auth_token_for_user( bigid, const audit::blame& );
     // void set_user_permissions( bigid, const permissions_type& );
+    // Cached per user role & per role while the listener started by
+    // `listen_for_permission_changes()` is connected
     permissions_type get_user_permissions( bigid );
     
+    // Starts a thread that keeps the permission caches in sync with the
+    // database by listening for `NOTIFY`s on two channels:
+    //   - `user_role_changed` with the user ID as the payload
+    //   - `role_permissions_changed` with the role ID as the payload
+    // An empty payload invalidates the whole cache for that channel.  The
+    // triggers sending these are in sql/permission_change_triggers.sql.
+    void listen_for_permission_changes();
+    
     void permissions_assert_any(
         const permissions_type& got,
         const permissions_type& expect
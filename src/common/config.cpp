@@ -3,27 +3,114 @@
 
 #include "config.hpp"
 
-#include <thread>
+#include "logging.hpp"
+
+#include <show/base64.hpp>
+
+#include <algorithm> // std::min()
+#include <atomic>
+#include <fstream>
+#include <limits>
+#include <memory>   // std::shared_ptr
+#include <mutex>
+#include <thread>   // std::thread::hardware_concurrency()
+#include <utility>  // std::move<>()
 
 
 namespace
 {
+    struct config_snapshot
+    {
+        nlj::json          json;
+        stickers::settings typed;
+    };
+    
+    // Only taken by writers and by readers picking up a new snapshot
     std::mutex config_mutex;
     
-    nlj::json global_config;
+    // Published snapshots are never modified, only replaced; every replacement
+    // bumps the generation so readers know to fetch the new one
+    std::shared_ptr< const config_snapshot > global_config{
+        std::make_shared< const config_snapshot >()
+    };
+    std::atomic< unsigned long long > config_generation{ 0 };
+    
+    // Each thread keeps its own reference to the last snapshot it saw, which
+    // only changes when that thread calls `refresh_config()`; this is what
+    // lets in-flight requests finish on the config they started with
+    thread_local std::shared_ptr< const config_snapshot > local_config;
+    thread_local unsigned long long local_generation{ ~0ull };
+    
+    void refresh_local_snapshot()
+    {
+        if(
+            config_generation.load( std::memory_order_acquire )
+            != local_generation
+        )
+        {
+            std::lock_guard< std::mutex > guard{ config_mutex };
+            local_config     = global_config;
+            local_generation = config_generation.load(
+                std::memory_order_relaxed
+            );
+        }
+    }
+    
+    const config_snapshot& local_snapshot()
+    {
+        if( !local_config )
+            refresh_local_snapshot();
+        return *local_config;
+    }
+    
+    // Some settings are only read when the server starts
+    void warn_restart_only_changes(
+        const stickers::settings& old_settings,
+        const stickers::settings& new_settings
+    )
+    {
+        auto& o{ old_settings.server };
+        auto& n{ new_settings.server };
+        
+        if(
+               o.host                   != n.host
+            || o.port                   != n.port
+            || o.extra_ports            != n.extra_ports
+            || o.worker_threads         != n.worker_threads
+            || o.max_queued_connections != n.max_queued_connections
+        )
+            STICKERS_LOG(
+                stickers::log_level::WARNING,
+                "changes to server host, port, or thread/queue settings will "
+                "not take effect until the server is restarted"
+            );
+        
+        auto& oa{ old_settings.auth };
+        auto& na{ new_settings.auth };
+        
+        if(
+               oa.password_hash_threads      != na.password_hash_threads
+            || oa.max_queued_password_hashes != na.max_queued_password_hashes
+        )
+            STICKERS_LOG(
+                stickers::log_level::WARNING,
+                "changes to password hashing thread/queue settings will not "
+                "take effect until the server is restarted"
+            );
+    }
     
     // Start at verbose so anything that happens before the config is loaded can
     // be diagnosed
-    stickers::log_level log_level_cache{
+    std::atomic< stickers::log_level > log_level_cache{
         stickers::log_level::VERBOSE
     };
     
-    void set_log_level()
+    void set_log_level( const nlj::json& config )
     {
-        auto level_setting{ global_config.find( "log_level" ) };
+        auto level_setting{ config.find( "log_level" ) };
         
         if(
-            level_setting == global_config.end()
+            level_setting == config.end()
             || !level_setting -> is_string()
         )
             log_level_cache = stickers::log_level::INFO;
@@ -42,6 +129,417 @@ namespace
         else
             log_level_cache = stickers::log_level::INFO;
     }
+    
+    // Don't lose log lines unless configured to
+    std::atomic< stickers::log_full_policy > log_full_policy_cache{
+        stickers::log_full_policy::BLOCK
+    };
+    
+    void set_log_full_policy( const nlj::json& config )
+    {
+        auto policy_setting{ config.find( "log_when_full" ) };
+        
+        if(
+            policy_setting != config.end()
+            && *policy_setting == "DROP"
+        )
+            log_full_policy_cache = stickers::log_full_policy::DROP;
+        else
+            log_full_policy_cache = stickers::log_full_policy::BLOCK;
+    }
+}
+
+
+namespace // Settings validation ///////////////////////////////////////////////
+{
+    const nlj::json& config_section(
+        const nlj::json  & config,
+        const std::string& section
+    )
+    {
+        auto found{ config.find( section ) };
+        if( found == config.end() || !found -> is_object() )
+            throw stickers::config_error{
+                "missing required config section \"" + section + "\""
+            };
+        return *found;
+    }
+    
+    template< typename T > T setting_value(
+        const nlj::json  & value,
+        const std::string& section,
+        const std::string& key
+    )
+    {
+        try
+        {
+            return value.get< T >();
+        }
+        catch( const nlj::json::exception& e )
+        {
+            throw stickers::config_error{
+                "config setting \""
+                + section
+                + "."
+                + key
+                + "\" has the wrong type: "
+                + e.what()
+            };
+        }
+    }
+    
+    template< typename T > T required_setting(
+        const nlj::json  & section_json,
+        const std::string& section,
+        const std::string& key
+    )
+    {
+        auto found{ section_json.find( key ) };
+        if( found == section_json.end() )
+            throw stickers::config_error{
+                "missing required config setting \""
+                + section
+                + "."
+                + key
+                + "\""
+            };
+        return setting_value< T >( *found, section, key );
+    }
+    
+    template< typename T > T optional_setting(
+        const nlj::json  & section_json,
+        const std::string& section,
+        const std::string& key,
+        const T          & default_value
+    )
+    {
+        auto found{ section_json.find( key ) };
+        if( found == section_json.end() )
+            return default_value;
+        return setting_value< T >( *found, section, key );
+    }
+    
+    template< typename T > void assert_setting_range(
+        T                  value,
+        T                  min,
+        T                  max,
+        const std::string& section,
+        const std::string& key
+    )
+    {
+        if( value < min || value > max )
+            throw stickers::config_error{
+                "config setting \""
+                + section
+                + "."
+                + key
+                + "\" must be between "
+                + std::to_string( min )
+                + " and "
+                + std::to_string( max )
+            };
+    }
+    
+    stickers::settings settings_from_json( const nlj::json& config )
+    {
+        stickers::settings s;
+        
+        {
+            auto& server{ config_section( config, "server" ) };
+            
+            unsigned int default_workers{
+                std::thread::hardware_concurrency() * 4
+            };
+            if( default_workers < 4 )
+                default_workers = 4;
+            
+            s.server = {
+                required_setting< std::string >( server, "server", "host" ),
+                required_setting< unsigned int >( server, "server", "port" ),
+                optional_setting< std::vector< unsigned int > >(
+                    server,
+                    "server",
+                    "extra_ports",
+                    {}
+                ),
+                required_setting< int >(
+                    server,
+                    "server",
+                    "wait_for_connection"
+                ),
+                required_setting< std::string >( server, "server", "admin" ),
+                required_setting< std::streamsize >(
+                    server,
+                    "server",
+                    "max_request_bytes"
+                ),
+                optional_setting< unsigned int >(
+                    server,
+                    "server",
+                    "worker_threads",
+                    default_workers
+                ),
+                optional_setting< std::size_t >(
+                    server,
+                    "server",
+                    "max_queued_connections",
+                    default_workers * 4
+                ),
+                optional_setting< unsigned int >(
+                    server,
+                    "server",
+                    "retry_after_seconds",
+                    1
+                ),
+                optional_setting< unsigned int >(
+                    server,
+                    "server",
+                    "keep_alive_idle_seconds",
+                    5
+                ),
+                optional_setting< std::string >(
+                    server,
+                    "server",
+                    "access_log",
+                    ""
+                )
+            };
+            
+            assert_setting_range< unsigned int >(
+                s.server.port,
+                1,
+                65535,
+                "server",
+                "port"
+            );
+            for( auto extra_port : s.server.extra_ports )
+                assert_setting_range< unsigned int >(
+                    extra_port,
+                    1,
+                    65535,
+                    "server",
+                    "extra_ports"
+                );
+            assert_setting_range< std::streamsize >(
+                s.server.max_request_bytes,
+                0,
+                std::numeric_limits< std::streamsize >::max(),
+                "server",
+                "max_request_bytes"
+            );
+            assert_setting_range< unsigned int >(
+                s.server.worker_threads,
+                1,
+                std::numeric_limits< unsigned int >::max(),
+                "server",
+                "worker_threads"
+            );
+            assert_setting_range< unsigned int >(
+                s.server.keep_alive_idle_seconds,
+                1,
+                std::numeric_limits< unsigned int >::max(),
+                "server",
+                "keep_alive_idle_seconds"
+            );
+        }
+        
+        {
+            auto& database{ config_section( config, "database" ) };
+            
+            const std::string name{ "database" };
+            
+            s.database = {
+                required_setting< std::string  >( database, name, "host"   ),
+                required_setting< unsigned int >( database, name, "port"   ),
+                required_setting< std::string  >( database, name, "user"   ),
+                required_setting< std::string  >( database, name, "pass"   ),
+                required_setting< std::string  >( database, name, "dbname" ),
+                optional_setting< unsigned int >(
+                    database,
+                    name,
+                    "pool_min_connections",
+                    1
+                ),
+                // Enough that workers rarely wait, without exceeding
+                // PostgreSQL's default `max_connections` of 100
+                optional_setting< unsigned int >(
+                    database,
+                    name,
+                    "pool_max_connections",
+                    std::min( s.server.worker_threads, 64u )
+                ),
+                optional_setting< unsigned int >(
+                    database,
+                    name,
+                    "pool_acquire_timeout_ms",
+                    5000
+                ),
+                optional_setting< unsigned int >(
+                    database,
+                    name,
+                    "pool_health_check_idle_ms",
+                    30000
+                ),
+                optional_setting< bool >(
+                    database,
+                    name,
+                    "prepared_statements",
+                    true
+                )
+            };
+            
+            assert_setting_range< unsigned int >(
+                s.database.pool_max_connections,
+                1,
+                std::numeric_limits< unsigned int >::max(),
+                name,
+                "pool_max_connections"
+            );
+            assert_setting_range< unsigned int >(
+                s.database.pool_min_connections,
+                0,
+                s.database.pool_max_connections,
+                name,
+                "pool_min_connections"
+            );
+        }
+        
+        {
+            auto& auth{ config_section( config, "auth" ) };
+            
+            s.auth.jwt_keys = required_setting<
+                std::map< std::string, std::string >
+            >( auth, "auth", "jwt_keys" );
+            if( s.auth.jwt_keys.empty() )
+                throw stickers::config_error{
+                    "config setting \"auth.jwt_keys\" must contain at least "
+                    "one key"
+                };
+            for( auto& kv : s.auth.jwt_keys )
+                try
+                {
+                    kv.second = show::base64_decode( kv.second );
+                }
+                catch( const show::base64_decode_error& e )
+                {
+                    throw stickers::config_error{
+                        "config setting \"auth.jwt_keys\" key \""
+                        + kv.first
+                        + "\" is not valid base64"
+                    };
+                }
+            
+            s.auth.token_lifetime = std::chrono::hours{
+                required_setting< int >( auth, "auth", "token_lifetime_hours" )
+            };
+            s.auth.token_cookie_name = required_setting< std::string >(
+                auth,
+                "auth",
+                "token_cookie_name"
+            );
+            s.auth.token_cookie_domain = required_setting< std::string >(
+                auth,
+                "auth",
+                "token_cookie_domain"
+            );
+            s.auth.token_cache_size = optional_setting< std::size_t >(
+                auth,
+                "auth",
+                "token_cache_size",
+                4096
+            );
+            // Off unless the database has the triggers from
+            // sql/permission_change_triggers.sql, without which cached roles &
+            // permissions would never be invalidated
+            s.auth.permission_cache_size = optional_setting< std::size_t >(
+                auth,
+                "auth",
+                "permission_cache_size",
+                0
+            );
+            
+            // Half the cores at most, so a burst of logins leaves the rest for
+            // other requests
+            auto default_hash_threads{
+                std::thread::hardware_concurrency() / 2
+            };
+            if( default_hash_threads < 1 )
+                default_hash_threads = 1;
+            
+            s.auth.password_hash_threads = optional_setting< unsigned int >(
+                auth,
+                "auth",
+                "password_hash_threads",
+                default_hash_threads
+            );
+            s.auth.max_queued_password_hashes = optional_setting<
+                std::size_t
+            >(
+                auth,
+                "auth",
+                "max_queued_password_hashes",
+                default_hash_threads * 4
+            );
+            s.auth.password_hashes_per_client = optional_setting<
+                unsigned int
+            >(
+                auth,
+                "auth",
+                "password_hashes_per_client",
+                2
+            );
+            s.auth.password_hashes_per_account = optional_setting<
+                unsigned int
+            >(
+                auth,
+                "auth",
+                "password_hashes_per_account",
+                1
+            );
+            
+            assert_setting_range< unsigned int >(
+                s.auth.password_hash_threads,
+                1,
+                std::numeric_limits< unsigned int >::max(),
+                "auth",
+                "password_hash_threads"
+            );
+            assert_setting_range< unsigned int >(
+                s.auth.password_hashes_per_client,
+                1,
+                std::numeric_limits< unsigned int >::max(),
+                "auth",
+                "password_hashes_per_client"
+            );
+            assert_setting_range< unsigned int >(
+                s.auth.password_hashes_per_account,
+                1,
+                std::numeric_limits< unsigned int >::max(),
+                "auth",
+                "password_hashes_per_account"
+            );
+        }
+        
+        {
+            auto& media{ config_section( config, "media" ) };
+            
+            s.media = {
+                required_setting< std::string >(
+                    media,
+                    "media",
+                    "media_directory"
+                ),
+                required_setting< std::string >( media, "media", "base_url" ),
+                required_setting< std::string >(
+                    media,
+                    "media",
+                    "temp_file_location"
+                )
+            };
+        }
+        
+        return s;
+    }
 }
 
 
@@ -49,52 +547,76 @@ namespace stickers
 {
     const nlj::json& config()
     {
-        // Not exactly great, but should be fine most of the time :^)
-        std::lock_guard< std::mutex > guard{ config_mutex };
-        return global_config;
+        return local_snapshot().json;
+    }
+    
+    const settings& current_settings()
+    {
+        return local_snapshot().typed;
     }
     
     void set_config( const nlj::json& o )
     {
-        std::lock_guard< std::mutex > guard{ config_mutex };
-        if( global_config == nullptr )
-            global_config = o;
-        set_log_level();
+        // Validate before taking the lock so a bad config never gets published
+        auto snapshot{ std::make_shared< const config_snapshot >(
+            config_snapshot{ o, settings_from_json( o ) }
+        ) };
+        
+        {
+            std::lock_guard< std::mutex > guard{ config_mutex };
+            
+            if( global_config -> json != nullptr )
+                warn_restart_only_changes(
+                    global_config -> typed,
+                    snapshot      -> typed
+                );
+            
+            global_config = std::move( snapshot );
+            config_generation.fetch_add( 1, std::memory_order_release );
+            set_log_level( global_config -> json );
+            set_log_full_policy( global_config -> json );
+        }
+        
+        refresh_local_snapshot();
     }
     
     void set_config( const std::string& s )
     {
-        std::lock_guard< std::mutex > guard{ config_mutex };
-        if( global_config == nullptr )
-            global_config = nlj::json::parse( s );
-        set_log_level();
+        set_config( nlj::json::parse( s ) );
     }
     
-    // void open_config( const std::string& f )
-    // {
-    //     std::lock_guard< std::mutex > guard{ config_mutex };
+    void open_config( const std::string& f )
+    {
+        std::ifstream config_file{ f };
+        
+        if( !config_file.is_open() )
+            throw config_error{ "could not open config file " + f };
         
-    //     std::ifstream config_file( f );
+        nlj::json parsed;
+        try
+        {
+            config_file >> parsed;
+        }
+        catch( const nlj::json::parse_error& e )
+        {
+            throw config_error{ "config file " + f + " not a valid JSON file" };
+        }
         
-    //     if( config_file.is_open() )
-    //     {
-    //         config_file >> global_config;
-    //         set_log_level();
-    //     }
-    //     else
-    //     {
-    //         ff::writeln(
-    //             std::cerr,
-    //             "could not open config file ",
-    //             argv[ 1 ]
-    //         );
-    //         return 2;
-    //     }
-    // }
+        set_config( parsed );
+    }
+    
+    void refresh_config()
+    {
+        refresh_local_snapshot();
+    }
     
     log_level current_log_level()
     {
-        std::lock_guard< std::mutex > guard{ config_mutex };
-        return log_level_cache;
+        return log_level_cache.load( std::memory_order_relaxed );
+    }
+    
+    log_full_policy current_log_full_policy()
+    {
+        return log_full_policy_cache.load( std::memory_order_relaxed );
     }
 }
@@ -3,18 +3,112 @@
 #define STICKERS_MOE_COMMON_CONFIG_HPP
 
 
+#include <chrono>
+#include <cstddef>  // std::size_t
+#include <exception>
+#include <ios>      // std::streamsize
+#include <map>
 #include <string>
+#include <vector>
 
 #include "json.hpp"
 
 
 namespace stickers
 {
+    // Settings validated & converted once when the config is set, so request
+    // handling reads plain fields instead of walking the JSON config
+    struct settings
+    {
+        struct server_settings
+        {
+            std::string     host;
+            unsigned int    port;
+            // Each gets its own listening socket & acceptor thread
+            std::vector< unsigned int > extra_ports;
+            int             wait_for_connection;    // Seconds
+            std::string     admin;
+            std::streamsize max_request_bytes;
+            unsigned int    worker_threads;
+            std::size_t     max_queued_connections;
+            unsigned int    retry_after_seconds;
+            // Longest a worker waits on a connection between requests
+            unsigned int    keep_alive_idle_seconds;
+            std::string     access_log;             // Path, empty to disable
+        };
+        
+        struct database_settings
+        {
+            std::string  host;
+            unsigned int port;
+            std::string  user;
+            std::string  pass;
+            std::string  dbname;
+            unsigned int pool_min_connections;
+            unsigned int pool_max_connections;
+            unsigned int pool_acquire_timeout_ms;
+            unsigned int pool_health_check_idle_ms;
+            bool         prepared_statements;
+        };
+        
+        struct auth_settings
+        {
+            // Key ID => base64-decoded signing key
+            std::map< std::string, std::string > jwt_keys;
+            std::chrono::hours                   token_lifetime;
+            std::string                          token_cookie_name;
+            std::string                          token_cookie_domain;
+            // Maximum entries in each cache, 0 to disable it
+            std::size_t                          token_cache_size;
+            std::size_t                          permission_cache_size;
+            // Pool for password hashes (e.g. logins), kept apart from the
+            // connection workers; the sizes are only read at startup
+            unsigned int                         password_hash_threads;
+            std::size_t                          max_queued_password_hashes;
+            unsigned int                         password_hashes_per_client;
+            unsigned int                         password_hashes_per_account;
+        };
+        
+        struct media_settings
+        {
+            std::string media_directory;
+            std::string base_url;
+            std::string temp_file_location;
+        };
+        
+        server_settings   server;
+        database_settings database;
+        auth_settings     auth;
+        media_settings    media;
+    };
+    
+    // Returns this thread's pinned config snapshot without locking; the
+    // reference stays valid until this thread calls `refresh_config()`
     const nlj::json& config();
+    // Typed view of the same snapshot as `config()`, with the same lifetime
+    const settings& current_settings();
     
+    // Publish a new config for threads to pick up on their next
+    // `refresh_config()`; throw `config_error` if the config is missing
+    // required settings or any have the wrong type, leaving the current config
+    // in place
     void  set_config( const nlj::json  & );
     void  set_config( const std::string& );
-    // void open_config( const std::string& );
+    void open_config( const std::string& );
+    
+    // Pin the latest published config for this thread; call only at points
+    // where no references into the previous snapshot are held (e.g. between
+    // requests).  Long-lived threads have to call this themselves: connection
+    // workers do between requests, password hashing workers between hashes,
+    // the access log flusher before each flush, and the acceptors & permission
+    // change listener on every loop; the log writer never reads the config, so
+    // never pins one.
+    void refresh_config();
+    
+    class config_error : public std::runtime_error
+    {
+        using runtime_error::runtime_error;
+    };
     
     enum class log_level
     {
@@ -27,6 +121,15 @@ namespace stickers
     };
     
     log_level current_log_level();
+    
+    // What a thread does when its log buffer is full
+    enum class log_full_policy
+    {
+        BLOCK,  // Wait for the writer thread to catch up, for up to a second
+        DROP    // Discard the line (counted & reported)
+    };
+    
+    log_full_policy current_log_full_policy();
 }
 
 
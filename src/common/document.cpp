@@ -20,6 +20,14 @@ namespace stickers // Document /////////////////////////////////////////////////
         return this -> at( key );
     }
     
+    map_document::map_document( request_arena& arena ) :
+        _map_document_base( allocator_type{ arena } )
+    {}
+    
+    array_document::array_document( request_arena& arena ) :
+        _array_document_base( allocator_type{ arena } )
+    {}
+    
     std::ostream& operator <<( std::ostream& out, const document& doc )
     {
         out << "doc(";
@@ -90,6 +98,17 @@ namespace stickers // Document /////////////////////////////////////////////////
             }
             out << '}';
         }
+        else if( doc.is_a< array_document >() )
+        {
+            auto& array{ doc.get< array_document >() };
+            out << '[';
+            for( std::size_t i = 0; i < array.size(); ++i )
+                out
+                    << array[ i ]
+                    << ( i + 1 < array.size() ? ", " : "" )
+                ;
+            out << ']';
+        }
         
         return out;
     }
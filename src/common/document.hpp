@@ -3,12 +3,16 @@
 #define STICKERS_MOE_COMMON_DOCUMENT_HPP
 
 
+#include "request_arena.hpp"
+
 #include <show.hpp>
 
+#include <functional> // std::less<>
 #include <map>
 #include <optional>
 #include <ostream>
 #include <string>
+#include <utility>  // std::pair<>
 #include <variant>
 #include <vector>
 
@@ -25,13 +29,35 @@ namespace stickers
     using    int_document = long;
     using  float_document = double;
     // Rather than just alias `std::map<...>` to `map_document`, make it a new
-    // class that exposes `std::map::at()` using the access operator
-    class map_document : public std::map< document_key_type, document >
+    // class that exposes `std::map::at()` using the access operator; this and
+    // `array_document` allocate from the request's arena when built by the
+    // request parsers, while copies of them use the heap (`arena_allocator`)
+    using _map_document_base = std::map<
+        document_key_type,
+        document,
+        std::less< document_key_type >,
+        arena_allocator< std::pair< const document_key_type, document > >
+    >;
+    class map_document : public _map_document_base
     {
     public:
-        using std::map< document_key_type, document >::map;
-        using std::map< document_key_type, document >::operator [];
+        using _map_document_base::map;
+        using _map_document_base::operator [];
         const document& operator []( const document_key_type& ) const;
+        
+        explicit map_document( request_arena& );
+    };
+    // Elements are stored contiguously rather than in a map keyed by index
+    using _array_document_base = std::vector<
+        document,
+        arena_allocator< document >
+    >;
+    class array_document : public _array_document_base
+    {
+    public:
+        using _array_document_base::vector;
+        
+        explicit array_document( request_arena& );
     };
     
     using _document_base = std::variant<
@@ -40,7 +66,8 @@ namespace stickers
           bool_document,
            int_document,
          float_document,
-           map_document
+           map_document,
+         array_document
     >;
     
     // Requires public inheritance so comparison operators can be used
@@ -192,19 +192,11 @@ namespace pqxx
             };
         }
         
+        // PostgreSQL's hex format for `BYTEA`, the same as `from_string()`
+        // accepts
         static std::string to_string( const stickers::sha256& h )
         {
-            std::string        encoded{ h.raw_digest() };
-            std::ostringstream decoded;
-            decoded << std::hex;
-            
-            for( auto& b : encoded )
-                if( std::isprint( b ) )
-                    decoded << b;
-                else
-                    decoded << "\\x" << static_cast< unsigned int >( b );
-            
-            return decoded.str();
+            return "\\x" + h.hex_digest();
         }
     };
 }
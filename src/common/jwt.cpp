@@ -8,25 +8,77 @@
 #include "logging.hpp"
 #include "string_utils.hpp"
 
-#include <cryptopp/hex.h>
 #include <cryptopp/hmac.h>
+#include <cryptopp/misc.h>      // CryptoPP::VerifyBufsEqual()
+#include <cryptopp/sha.h>
 #include <show/base64.hpp>
 
+#include <array>
+#include <cstddef>      // std::size_t
 #include <cstdlib>      // std::rand()
+#include <map>
+#include <optional>
 
 
-namespace stickers
+namespace // Signing ///////////////////////////////////////////////////////////
 {
-    const jwt jwt::parse( const std::string& raw )
+    using hs512_signature = std::array<
+        CryptoPP::byte,
+        CryptoPP::SHA512::DIGESTSIZE
+    >;
+    
+    // Keying an HMAC is the expensive part of setting one up, so each thread
+    // keeps one per key ID that's only re-keyed if that ID's key changes (e.g.
+    // after a config reload); Crypto++ HMACs are ready for the next message
+    // as soon as one is finalized.  `signing_keys` is the full set `key` came
+    // from, so HMACs for key IDs since retired can be dropped.
+    hs512_signature sign_hs512(
+        const std::map< std::string, std::string >& signing_keys,
+        const std::string                         & kid,
+        const std::string                         & key,
+        const char                                * data,
+        std::size_t                                 size
+    )
     {
-        auto signing_keys = config()[ "auth" ][ "jwt_keys" ].get<
-            std::map< std::string, std::string >
-        >();
+        struct keyed_hmac
+        {
+            std::optional< std::string >       key;
+            CryptoPP::HMAC< CryptoPP::SHA512 > hmac;
+        };
+        thread_local std::map< std::string, keyed_hmac > hmacs;
         
-        for( auto& kv : signing_keys )
-            kv.second = show::base64_decode( kv.second );
+        for( auto iter{ hmacs.begin() }; iter != hmacs.end(); )
+            if( signing_keys.count( iter -> first ) )
+                ++iter;
+            else
+                iter = hmacs.erase( iter );
         
-        return parse( raw, signing_keys );
+        auto& keyed{ hmacs[ kid ] };
+        if( keyed.key != key )
+        {
+            keyed.hmac.SetKey(
+                reinterpret_cast< const CryptoPP::byte* >( key.data() ),
+                key.size()
+            );
+            keyed.key = key;
+        }
+        
+        hs512_signature signature;
+        keyed.hmac.Update(
+            reinterpret_cast< const CryptoPP::byte* >( data ),
+            size
+        );
+        keyed.hmac.Final( signature.data() );
+        return signature;
+    }
+}
+
+
+namespace stickers
+{
+    const jwt jwt::parse( const std::string& raw )
+    {
+        return parse( raw, current_settings().auth.jwt_keys );
     }
     
     const jwt jwt::parse(
@@ -37,7 +89,6 @@ namespace stickers
         auto token{ parse_no_validate( raw ) };
         
         auto split_pos{ raw.rfind( "." ) };
-        auto payload{ raw.substr( 0, split_pos ) };
         std::string signature;
         
         try
@@ -82,32 +133,25 @@ namespace stickers
         {
         case signature_alg::HS512:
             {
-                bool validated{ false };
-                
-                CryptoPP::HMAC< CryptoPP::SHA512 > hmac{
-                    reinterpret_cast< const CryptoPP::byte* >(
-                        signing_key_found -> second.c_str()
-                    ),
-                    signing_key_found -> second.size()
-                };
-                
-                // Seems like a good place to use
-                // `CryptoPP::HashVerificationFilter::PUT_HASH`, but there's no
-                // documentation on how to use that flag.  I hate Crypto++.
-                CryptoPP::StringSource{
-                    payload + signature,
-                    true,
-                    new CryptoPP::HashVerificationFilter{
-                        hmac,
-                        new CryptoPP::ArraySink{
-                            reinterpret_cast< CryptoPP::byte* >( &validated ),
-                            sizeof( validated )
-                        },
-                        (
-                              CryptoPP::HashVerificationFilter::HASH_AT_END
-                            | CryptoPP::HashVerificationFilter::PUT_RESULT
-                        )
-                    }
+                // Signs the header & claims segments in place rather than
+                // copying them, and compares in constant time so the
+                // comparison doesn't leak how much of a forgery was right
+                auto expected{ sign_hs512(
+                    signing_keys,
+                    signing_key_found -> first,
+                    signing_key_found -> second,
+                    raw.data(),
+                    split_pos
+                ) };
+                bool validated{
+                    signature.size() == expected.size()
+                    && CryptoPP::VerifyBufsEqual(
+                        expected.data(),
+                        reinterpret_cast< const CryptoPP::byte* >(
+                            signature.data()
+                        ),
+                        expected.size()
+                    )
                 };
                 
                 if( !validated )
@@ -144,10 +188,9 @@ namespace stickers
         std::string  claims_string;
         
         {
-            auto jwt_segments{ split< std::vector< std::string > >(
-                raw,
-                std::string{ "." }
-            ) };
+            auto jwt_segments{
+                split< std::vector< std::string > >( raw, "." )
+            };
             
             if( jwt_segments.size() != 3 )
                 throw structure_error{ "token does not have 3 segments" };
@@ -403,16 +446,9 @@ namespace stickers
     
     std::string jwt::serialize( const jwt& token )
     {
-        auto signing_keys{ config()[ "auth" ][ "jwt_keys" ].get<
-            std::map< std::string, std::string >
-        >() };
-        
-        for( auto& kv : signing_keys )
-            kv.second = show::base64_decode( kv.second );
-        
         return serialize(
             token,
-            signing_keys
+            current_settings().auth.jwt_keys
         );
     }
     
@@ -433,7 +469,8 @@ namespace stickers
         else
             header[ "jti" ] = uuid::generate().hex_value();
         
-        std::string signing_key_string;
+        const std::string* signing_kid;
+        const std::string* signing_key;
         if( token.kid )
         {
             // Find the specified signing key in `signing_keys`
@@ -443,8 +480,8 @@ namespace stickers
                     "specified a JWT signing key that does not exist in the "
                     "available options"
                 };
-            header[ "kid" ]    = key_found -> first;
-            signing_key_string = key_found -> second;
+            signing_kid = &key_found -> first;
+            signing_key = &key_found -> second;
         }
         else
         {
@@ -453,9 +490,10 @@ namespace stickers
             auto key_to_use{ signing_keys.begin() };
             for( int i = 0; i < random_int; ++i )
                 ++key_to_use;
-            header[ "kid" ]    = key_to_use -> first;
-            signing_key_string = key_to_use -> second;
+            signing_kid = &key_to_use -> first;
+            signing_key = &key_to_use -> second;
         }
+        header[ "kid" ] = *signing_kid;
         
         // Make a writable copy of the claims
         auto claims{ token.claims };
@@ -489,26 +527,16 @@ namespace stickers
             + "."
             + show::base64_encode( claims.dump(), show::base64_chars_urlsafe )
         };
-        std::string signature_string;
-        
-        CryptoPP::HMAC< CryptoPP::SHA512 > hmac{
-            reinterpret_cast< const CryptoPP::byte* >(
-                signing_key_string.c_str()
-            ),
-            signing_key_string.size()
-        };
-        
-        CryptoPP::StringSource{
-            header_claims_string,
-            true,
-            new CryptoPP::HashFilter{
-                hmac,
-                new CryptoPP::StringSink{ signature_string }
-            }
-        };
+        auto signature{ sign_hs512(
+            signing_keys,
+            *signing_kid,
+            *signing_key,
+            header_claims_string.data(),
+            header_claims_string.size()
+        ) };
         
         return header_claims_string + "." + show::base64_encode(
-            signature_string,
+            std::string{ signature.begin(), signature.end() },
             show::base64_chars_urlsafe
         );
     }
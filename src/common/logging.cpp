@@ -0,0 +1,327 @@
+#line 2 "common/logging.cpp"
+
+
+#include "logging.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <iostream>
+#include <memory>   // std::shared_ptr
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace
+{
+    struct log_entry
+    {
+        std::string line;
+        bool        error;
+    };
+    
+    // Single-producer, single-consumer queue of finished lines; each logging
+    // thread owns one and the writer thread drains all of them
+    class log_ring
+    {
+    public:
+        explicit log_ring( std::size_t capacity ) : slots( capacity ) {}
+        
+        // Producer side; leaves `entry` untouched if the ring is full
+        bool try_push( log_entry& entry )
+        {
+            auto t{ tail.load( std::memory_order_relaxed ) };
+            if( t - head.load( std::memory_order_acquire ) >= slots.size() )
+                return false;
+            slots[ t % slots.size() ] = std::move( entry );
+            tail.store( t + 1, std::memory_order_release );
+            return true;
+        }
+        
+        // Consumer side
+        bool try_pop( log_entry& entry )
+        {
+            auto h{ head.load( std::memory_order_relaxed ) };
+            if( h == tail.load( std::memory_order_acquire ) )
+                return false;
+            entry = std::move( slots[ h % slots.size() ] );
+            head.store( h + 1, std::memory_order_release );
+            return true;
+        }
+        
+        bool empty() const
+        {
+            return (
+                head.load( std::memory_order_acquire )
+                == tail.load( std::memory_order_acquire )
+            );
+        }
+        
+        // Set once the owning thread has exited, after which the ring can be
+        // discarded as soon as it's drained
+        std::atomic< bool > orphaned{ false };
+        
+    protected:
+        std::vector< log_entry >   slots;
+        std::atomic< std::size_t > head{ 0 };
+        std::atomic< std::size_t > tail{ 0 };
+    };
+    
+    const std::size_t ring_capacity{ 1024 };
+    
+    // Longest a thread waits for room in its ring under `log_full_policy::BLOCK`
+    // before dropping the line anyway, so a stalled writer (e.g. on a full
+    // disk) can't stall every thread that logs
+    const std::chrono::milliseconds max_block_time{ 1000 };
+    
+    class log_writer
+    {
+    public:
+        log_writer() : writer{ &log_writer::run, this } {}
+        
+        ~log_writer()
+        {
+            {
+                std::lock_guard< std::mutex > guard{ wake_mutex };
+                stopping = true;
+            }
+            wake.notify_one();
+            writer.join();
+        }
+        
+        std::shared_ptr< log_ring > add_ring()
+        {
+            auto ring{ std::make_shared< log_ring >( ring_capacity ) };
+            std::lock_guard< std::mutex > guard{ rings_mutex };
+            rings.push_back( ring );
+            return ring;
+        }
+        
+        void submit( log_ring& ring, log_entry& entry )
+        {
+            if( ring.try_push( entry ) )
+                return;
+            
+            // Once one thread has given up waiting, others don't bother until
+            // the writer has made progress again
+            if(
+                stickers::current_log_full_policy()
+                    == stickers::log_full_policy::DROP
+                || stalled.load()
+            )
+            {
+                ++dropped;
+                return;
+            }
+            
+            auto deadline{ std::chrono::steady_clock::now() + max_block_time };
+            
+            // `wake_mutex` is held between checking the ring & waiting, so the
+            // writer can't signal a drain in between
+            std::unique_lock< std::mutex > lock{ wake_mutex };
+            while( true )
+            {
+                // `entry` is moved from once pushed, so return right away
+                if( ring.try_push( entry ) )
+                    return;
+                
+                wake.notify_one();
+                if(
+                    drained.wait_until( lock, deadline )
+                    == std::cv_status::timeout
+                )
+                {
+                    if( ring.try_push( entry ) )
+                        return;
+                    
+                    stalled = true;
+                    ++dropped;
+                    return;
+                }
+            }
+        }
+        
+    protected:
+        std::mutex                                 rings_mutex;
+        std::vector< std::shared_ptr< log_ring > > rings;
+        
+        std::mutex                        wake_mutex;
+        std::condition_variable           wake;
+        std::condition_variable           drained;
+        bool                              stopping{ false };
+        std::atomic< bool               > stalled { false };
+        std::atomic< unsigned long long > dropped { 0     };
+        
+        // Declared last so everything it uses exists before it starts
+        std::thread writer;
+        
+        void run()
+        {
+            while( true )
+            {
+                bool stop;
+                {
+                    std::unique_lock< std::mutex > lock{ wake_mutex };
+                    wake.wait_for(
+                        lock,
+                        std::chrono::milliseconds{ 10 },
+                        [ this ]{ return stopping; }
+                    );
+                    stop = stopping;
+                }
+                
+                drain();
+                
+                // Let threads waiting for room in their ring try again
+                {
+                    std::lock_guard< std::mutex > guard{ wake_mutex };
+                    stalled = false;
+                }
+                drained.notify_all();
+                
+                if( stop )
+                    return;
+            }
+        }
+        
+        void drain()
+        {
+            std::vector< std::shared_ptr< log_ring > > current_rings;
+            {
+                std::lock_guard< std::mutex > guard{ rings_mutex };
+                
+                // Orphaned rings can't receive any more lines, so once empty
+                // they're done with
+                for( auto ring{ rings.begin() }; ring != rings.end(); )
+                    if( ( *ring ) -> orphaned && ( *ring ) -> empty() )
+                        ring = rings.erase( ring );
+                    else
+                        ++ring;
+                
+                current_rings = rings;
+            }
+            
+            bool wrote_out{ false };
+            bool wrote_err{ false };
+            log_entry entry;
+            
+            for( auto& ring : current_rings )
+                while( ring -> try_pop( entry ) )
+                    if( entry.error )
+                    {
+                        std::cerr << entry.line;
+                        wrote_err = true;
+                    }
+                    else
+                    {
+                        std::cout << entry.line;
+                        wrote_out = true;
+                    }
+            
+            // Written directly, logging this could itself be dropped
+            if( auto count{ dropped.exchange( 0 ) } )
+            {
+                ff::writeln(
+                    std::cerr,
+                    "[WARNING][",
+                    stickers::log_timestamp(),
+                    "][thread ",
+                    stickers::log_thread_id(),
+                    "] log buffer full, dropped ",
+                    std::to_string( count ),
+                    " lines"
+                );
+                wrote_err = true;
+            }
+            
+            if( wrote_out )
+                std::cout.flush();
+            if( wrote_err )
+                std::cerr.flush();
+        }
+    };
+    
+    log_writer& shared_writer()
+    {
+        static log_writer writer;
+        return writer;
+    }
+    
+    struct ring_owner
+    {
+        std::shared_ptr< log_ring > ring;
+        
+        ~ring_owner()
+        {
+            if( ring )
+                ring -> orphaned = true;
+        }
+    };
+    
+    thread_local ring_owner local_ring;
+}
+
+
+namespace stickers
+{
+    void write_log_line( log_level level, std::string&& line )
+    {
+        auto& writer{ shared_writer() };
+        
+        if( !local_ring.ring )
+            local_ring.ring = writer.add_ring();
+        
+        log_entry entry{ std::move( line ), level == log_level::ERROR };
+        writer.submit( *local_ring.ring, entry );
+    }
+    
+    const char* log_level_name( log_level level )
+    {
+        switch( level )
+        {
+        case log_level::SILENT : return "SILENT";
+        case log_level::ERROR  : return "ERROR";
+        case log_level::WARNING: return "WARNING";
+        case log_level::INFO   : return "INFO";
+        case log_level::VERBOSE: return "VERBOSE";
+        case log_level::DEBUG  : return "DEBUG";
+        }
+        return "UNKNOWN";
+    }
+    
+    const std::string& log_timestamp()
+    {
+        thread_local std::time_t cached_second{ -1 };
+        thread_local std::string cached_string;
+        
+        auto t{ std::time( nullptr ) };
+        if( t != cached_second )
+        {
+            std::tm local_time;
+            localtime_r( &t, &local_time );
+            
+            char buffer[ 32 ];
+            cached_string.assign( buffer, std::strftime(
+                buffer,
+                sizeof( buffer ),
+                "%F %T%z",
+                &local_time
+            ) );
+            cached_second = t;
+        }
+        
+        return cached_string;
+    }
+    
+    const std::string& log_thread_id()
+    {
+        thread_local std::string id_string{ []{
+            std::stringstream s;
+            s << std::this_thread::get_id();
+            return s.str();
+        }() };
+        return id_string;
+    }
+}
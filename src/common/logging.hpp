@@ -7,51 +7,42 @@
 #include "timestamp.hpp"
 #include "formatting.hpp"
 
-#include <ctime>
 #include <cctype>
-#include <iostream>
-#include <map>
+#include <iomanip>  // std::setw(), std::setfill()
 #include <sstream>
-#include <thread>
+#include <string>
+#include <utility>  // std::move<>()
 
 
 namespace stickers
 {
+    // Lines are formatted on the calling thread but written out by a
+    // background thread; see `logging.cpp`
+    void write_log_line( log_level, std::string&& );
+    
+    const char* log_level_name( log_level );
+    // Both cached per thread; the timestamp is only re-formatted when the
+    // second changes
+    const std::string& log_timestamp();
+    const std::string& log_thread_id();
+    
     template< typename... Args > void log(
-        log_level   level,
-        std::string file_name,
-        long long   file_line,
-        Args...     args
+        log_level      level,
+        const char*    file_name,
+        long long      file_line,
+        const Args&... args
     )
     {
-        static const std::map< log_level, std::string > level_strings{
-            { log_level::SILENT , "SILENT"  },
-            { log_level::ERROR  , "ERROR"   },
-            { log_level::WARNING, "WARNING" },
-            { log_level::INFO   , "INFO"    },
-            { log_level::VERBOSE, "VERBOSE" },
-            { log_level::DEBUG  , "DEBUG"   }
-        };
-        
         if( current_log_level() >= level )
         {
-            auto t{ std::time( nullptr ) };
-            std::stringstream time_string;
-            time_string << std::put_time(
-                std::localtime( &t ),
-                "%F %T%z"
-            );
-            
-            std::stringstream thread_id_string;
-            thread_id_string << std::this_thread::get_id();
-            
+            std::string line;
             ff::writeln(
-                ( level == log_level::ERROR ? std::cerr : std::cout ),
-                "["       , level_strings.at( level ), "]",
-                "["       , time_string.str()        , "]",
-                "[thread ", thread_id_string.str()   , "]",
+                line,
+                "["       , log_level_name( level ), "]",
+                "["       , log_timestamp()        , "]",
+                "[thread ", log_thread_id()        , "]",
                 current_log_level() >= log_level::DEBUG ? (
-                    static_cast< std::string >( "[" )
+                    std::string{ "[" }
                     + file_name
                     + ":"
                     + std::to_string( file_line )
@@ -59,6 +50,7 @@ namespace stickers
                 ) : "",
                 args...
             );
+            write_log_line( level, std::move( line ) );
         }
     }
     
@@ -87,12 +79,27 @@ namespace stickers
 }
 
 
-#define STICKERS_LOG( LEVEL, ... ) stickers::log( \
-    LEVEL, \
-    __FILE__, \
-    __LINE__, \
-    __VA_ARGS__ \
-)
+// Call sites for levels more verbose than this are compiled out entirely,
+// e.g. `-DSTICKERS_MIN_LOG_LEVEL=30` keeps only INFO and above; the numbers are
+// those of `stickers::log_level`
+#ifndef STICKERS_MIN_LOG_LEVEL
+#define STICKERS_MIN_LOG_LEVEL 50
+#endif
+
+
+// Arguments are only evaluated if the line will actually be logged
+#define STICKERS_LOG( LEVEL, ... ) do{ \
+    if constexpr( \
+        static_cast< int >( LEVEL ) <= STICKERS_MIN_LOG_LEVEL \
+    ) \
+        if( stickers::current_log_level() >= ( LEVEL ) ) \
+            stickers::log( \
+                LEVEL, \
+                __FILE__, \
+                __LINE__, \
+                __VA_ARGS__ \
+            ); \
+}while( false )
 
 
 #endif
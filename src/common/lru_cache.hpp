@@ -0,0 +1,139 @@
+#pragma once
+#ifndef STICKERS_MOE_COMMON_LRU_CACHE_HPP
+#define STICKERS_MOE_COMMON_LRU_CACHE_HPP
+
+
+#include <array>
+#include <cstddef>      // std::size_t
+#include <functional>   // std::hash<>, std::reference_wrapper<>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>      // std::pair<>
+
+
+namespace stickers
+{
+    // Bounded map that evicts its least recently used entries, split into
+    // shards by key hash that each have their own lock so concurrent lookups
+    // of different keys rarely wait on each other
+    template<
+        typename Key,
+        typename Value,
+        typename Hash  = std::hash< Key >,
+        typename Equal = std::equal_to< Key >
+    > class sharded_lru_cache
+    {
+    public:
+        static constexpr unsigned int shard_bits { 4                };
+        static constexpr std::size_t  shard_count{ 1u << shard_bits };
+        
+        // Returns a copy so the entry can be evicted while it's in use
+        std::optional< Value > find( const Key& key )
+        {
+            auto& s{ shard_for( key ) };
+            std::lock_guard< std::mutex > guard{ s.mutex };
+            
+            auto found{ s.index.find( std::cref( key ) ) };
+            if( found == s.index.end() )
+                return std::nullopt;
+            
+            s.entries.splice( s.entries.begin(), s.entries, found -> second );
+            return found -> second -> second;
+        }
+        
+        // Replaces any existing entry, then evicts entries until the whole
+        // cache holds at most `capacity`; does nothing if `capacity` is 0
+        void insert( const Key& key, Value value, std::size_t capacity )
+        {
+            auto shard_capacity{ ( capacity + shard_count - 1 ) / shard_count };
+            if( !shard_capacity )
+                return;
+            
+            auto& s{ shard_for( key ) };
+            std::lock_guard< std::mutex > guard{ s.mutex };
+            
+            auto found{ s.index.find( std::cref( key ) ) };
+            if( found != s.index.end() )
+            {
+                found -> second -> second = std::move( value );
+                s.entries.splice(
+                    s.entries.begin(),
+                    s.entries,
+                    found -> second
+                );
+                return;
+            }
+            
+            s.entries.emplace_front( key, std::move( value ) );
+            s.index.emplace(
+                std::cref( s.entries.front().first ),
+                s.entries.begin()
+            );
+            
+            while( s.entries.size() > shard_capacity )
+            {
+                s.index.erase( std::cref( s.entries.back().first ) );
+                s.entries.pop_back();
+            }
+        }
+        
+        void erase( const Key& key )
+        {
+            auto& s{ shard_for( key ) };
+            std::lock_guard< std::mutex > guard{ s.mutex };
+            
+            auto found{ s.index.find( std::cref( key ) ) };
+            if( found != s.index.end() )
+            {
+                auto entry{ found -> second };
+                s.index.erase( found );
+                s.entries.erase( entry );
+            }
+        }
+        
+        void clear()
+        {
+            for( auto& s : shards )
+            {
+                std::lock_guard< std::mutex > guard{ s.mutex };
+                s.index.clear();
+                s.entries.clear();
+            }
+        }
+    
+    protected:
+        using entry_list = std::list< std::pair< const Key, Value > >;
+        
+        // Index keys refer to the keys stored in the entries, which don't
+        // move, so each key is only stored once
+        struct shard
+        {
+            alignas( 64 ) std::mutex mutex;
+            entry_list               entries;  // Most recently used first
+            std::unordered_map<
+                std::reference_wrapper< const Key >,
+                typename entry_list::iterator,
+                Hash,
+                Equal
+            > index;
+        };
+        
+        std::array< shard, shard_count > shards;
+        
+        shard& shard_for( const Key& key )
+        {
+            // Mix the hash so shards don't just follow its low bits, which the
+            // index's buckets also use
+            auto mixed{
+                static_cast< unsigned long long >( Hash{}( key ) )
+                * 0x9E3779B97F4A7C15ull
+            };
+            return shards[ mixed >> ( 64 - shard_bits ) ];
+        }
+    };
+}
+
+
+#endif
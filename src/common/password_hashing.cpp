@@ -0,0 +1,163 @@
+#line 2 "common/password_hashing.cpp"
+
+
+#include "password_hashing.hpp"
+
+#include "config.hpp"
+#include "postgres.hpp"
+#include "worker_pool.hpp"
+
+#include <future>
+#include <memory>   // std::unique_ptr<>, std::make_shared<>()
+#include <mutex>
+#include <unordered_map>
+
+
+namespace
+{
+    // Created by `start_password_hashing()`
+    std::unique_ptr< stickers::worker_pool > hashing_workers;
+    
+    // Hashes queued or running per client address & per account
+    struct in_progress_counts
+    {
+        std::mutex                                      mutex;
+        std::unordered_map< std::string, unsigned int > clients;
+        std::unordered_map< std::string, unsigned int > accounts;
+    } in_progress;
+    
+    unsigned int count_for(
+        const std::unordered_map< std::string, unsigned int >& counts,
+        const std::string                                    & key
+    )
+    {
+        auto found{ counts.find( key ) };
+        return found == counts.end() ? 0 : found -> second;
+    }
+    
+    void release(
+        std::unordered_map< std::string, unsigned int >& counts,
+        const std::string                              & key
+    )
+    {
+        if( key.empty() )
+            return;
+        
+        auto found{ counts.find( key ) };
+        if( found != counts.end() && --( found -> second ) == 0 )
+            counts.erase( found );
+    }
+    
+    // Counts one hash against its client & account for as long as it exists
+    class in_progress_slot
+    {
+    public:
+        in_progress_slot(
+            const std::string& client,
+            const std::string& account
+        ) :
+            client { client  },
+            account{ account }
+        {
+            auto& auth_settings{ stickers::current_settings().auth };
+            
+            std::lock_guard< std::mutex > guard{ in_progress.mutex };
+            
+            if(
+                !client.empty()
+                && count_for( in_progress.clients, client )
+                    >= auth_settings.password_hashes_per_client
+            )
+                throw stickers::password_hashing_busy{
+                    "too many password hashes in progress for client "
+                    + client
+                };
+            if(
+                !account.empty()
+                && count_for( in_progress.accounts, account )
+                    >= auth_settings.password_hashes_per_account
+            )
+                throw stickers::password_hashing_busy{
+                    "too many password hashes in progress for account "
+                    + account
+                };
+            
+            if( !client.empty() )
+                ++in_progress.clients[ client ];
+            if( !account.empty() )
+                ++in_progress.accounts[ account ];
+        }
+        
+        ~in_progress_slot()
+        {
+            std::lock_guard< std::mutex > guard{ in_progress.mutex };
+            release( in_progress.clients , client  );
+            release( in_progress.accounts, account );
+        }
+        
+        in_progress_slot( const in_progress_slot& ) = delete;
+        in_progress_slot& operator =( const in_progress_slot& ) = delete;
+    
+    protected:
+        const std::string client;
+        const std::string account;
+    };
+}
+
+
+namespace stickers
+{
+    void start_password_hashing()
+    {
+        auto& auth_settings{ current_settings().auth };
+        
+        hashing_workers = std::make_unique< worker_pool >(
+            auth_settings.password_hash_threads,
+            auth_settings.max_queued_password_hashes
+        );
+    }
+    
+    void run_password_hash(
+        const std::function< void() >& hash,
+        const std::string            & client,
+        const std::string            & account
+    )
+    {
+        // Otherwise a burst of logins could use up every pooled connection
+        if( postgres::transaction_open() )
+            throw std::logic_error{
+                "password hash started inside a database transaction"
+            };
+        
+        if( !hashing_workers )
+        {
+            hash();
+            return;
+        }
+        
+        in_progress_slot slot{ client, account };
+        
+        // Shared with the job so the worker is never left holding a promise
+        // this thread has already destroyed
+        auto done    { std::make_shared< std::promise< void > >() };
+        auto finished{ done -> get_future() };
+        
+        if( !hashing_workers -> try_enqueue( [ &hash, done ]{
+            // Pick up any reloaded config between hashes, never during
+            refresh_config();
+            
+            try
+            {
+                hash();
+                done -> set_value();
+            }
+            catch( ... )
+            {
+                done -> set_exception( std::current_exception() );
+            }
+        } ) )
+            throw password_hashing_busy{ "password hashing queue full" };
+        
+        finished.get();
+    }
+}
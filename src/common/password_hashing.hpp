@@ -0,0 +1,39 @@
+#pragma once
+#ifndef STICKERS_MOE_COMMON_PASSWORD_HASHING_HPP
+#define STICKERS_MOE_COMMON_PASSWORD_HASHING_HPP
+
+
+#include <functional>   // std::function
+#include <stdexcept>
+#include <string>
+
+
+namespace stickers
+{
+    // Thrown instead of hashing when the hashing pool's queue is full or the
+    // client or account already has as many hashes in progress as allowed
+    class password_hashing_busy : public std::runtime_error
+    {
+        using runtime_error::runtime_error;
+    };
+    
+    // Creates the pool `run_password_hash()` uses, sized from the current
+    // config; call once at startup, before any requests are served
+    void start_password_hashing();
+    
+    // Runs `hash` on the password hashing pool & waits for it to finish, so
+    // expensive hashes can't take every core away from other requests; counts
+    // against the per-client & per-account caps unless the key is empty.
+    // Rethrows anything `hash` throws.  Without a pool (e.g. in the utilities)
+    // `hash` just runs on the calling thread.  Throws `std::logic_error` if
+    // called inside a database transaction, as waiting would hold its
+    // connection.
+    void run_password_hash(
+        const std::function< void() >& hash,
+        const std::string            & client,
+        const std::string            & account
+    );
+}
+
+
+#endif
@@ -6,23 +6,525 @@
 #include "config.hpp"
 #include "logging.hpp"
 
+#include <algorithm>    // std::max()
+#include <condition_variable>
+#include <mutex>
+#include <utility>      // std::move<>()
+#include <vector>
+
+
+namespace
+{
+    // Function-local so statements defined at namespace scope in any
+    // translation unit can register themselves during static initialization
+    std::vector< const stickers::postgres::statement* >& registered_statements()
+    {
+        static std::vector< const stickers::postgres::statement* > statements;
+        return statements;
+    }
+    
+    std::string connection_string(
+        const std::string& host,
+        unsigned int       port,
+        const std::string& user,
+        const std::string& pass,
+        const std::string& dbname
+    )
+    {
+        return (
+                "host="    + ( host   == "" ? "''" : host   )
+            + " port="     + std::to_string( port )
+            + " user="     + ( user   == "" ? "''" : user   )
+            + " password=" + ( pass   == "" ? "''" : pass   )
+            + " dbname="   + ( dbname == "" ? "''" : dbname )
+        );
+    }
+    
+    std::string connection_string(
+        const stickers::settings::database_settings& pg_settings
+    )
+    {
+        // TODO: Make all of these optional
+        return connection_string(
+            pg_settings.host,
+            pg_settings.port,
+            pg_settings.user,
+            pg_settings.pass,
+            pg_settings.dbname
+        );
+    }
+    
+    std::unique_ptr< pqxx::connection > open_connection(
+        const std::string& parameters
+    )
+    {
+        auto connection{ std::make_unique< pqxx::connection >( parameters ) };
+        
+        for( auto query : registered_statements() )
+            connection -> prepare( query -> name, query -> sql );
+        
+        STICKERS_LOG(
+            stickers::log_level::VERBOSE,
+            "created PostgreSQL connection {host=",
+            connection -> hostname(),
+            " port=",
+            connection -> port(),
+            " user=",
+            connection -> username(),
+            " dbname=",
+            connection -> dbname(),
+            "}"
+        );
+        
+        return connection;
+    }
+    
+    // Connections that have sat idle for a while may have been dropped by the
+    // server or a proxy in between, so ping them before handing them out
+    bool connection_healthy( pqxx::connection& connection )
+    {
+        try
+        {
+            pqxx::nontransaction ping{ connection };
+            ping.exec( "SELECT 1" );
+            return true;
+        }
+        catch( const std::exception& e )
+        {
+            STICKERS_LOG(
+                stickers::log_level::WARNING,
+                "discarding broken pooled PostgreSQL connection: ",
+                e.what()
+            );
+            return false;
+        }
+    }
+}
+
 
 namespace stickers
 {
     namespace postgres
     {
-        std::unique_ptr< pqxx::connection > connect()
+        class connection_pool
         {
-            auto& pg_config{ config()[ "database" ] };
+        public:
+            connection_lease acquire( const settings::database_settings& );
+            void release(
+                std::unique_ptr< pqxx::connection >&,
+                unsigned long long generation
+            );
+            void warm( const settings::database_settings& );
+            pool_stats stats() const;
+        
+        protected:
+            using clock_type = std::chrono::steady_clock;
             
-            // TODO: Make all of these optional
-            return connect(
-                pg_config[ "host"   ].get< std::string >(),
-                pg_config[ "port"   ].get< int         >(),
-                pg_config[ "user"   ].get< std::string >(),
-                pg_config[ "pass"   ].get< std::string >(),
-                pg_config[ "dbname" ].get< std::string >()
+            struct idle_connection
+            {
+                std::unique_ptr< pqxx::connection > connection;
+                unsigned long long                  generation;
+                clock_type::time_point              since;
+            };
+            
+            mutable std::mutex             pool_mutex;
+            std::condition_variable        available;
+            // Used as a stack so the most recently returned connections are
+            // reused first and rarely need a health check
+            std::vector< idle_connection > idle;
+            
+            // Connections opened with different parameters (i.e. before a
+            // config reload changed them) are closed instead of being reused
+            std::string        parameters;
+            unsigned long long generation{ 0 };
+            std::size_t        max_open  { 1 };
+            
+            std::size_t               open        { 0 };
+            std::size_t               in_use      { 0 };
+            unsigned long long        created     { 0 };
+            unsigned long long        acquisitions{ 0 };
+            unsigned long long        timeouts    { 0 };
+            std::chrono::microseconds total_wait  { 0 };
+            std::chrono::microseconds max_wait    { 0 };
+            
+            // Must be called with `pool_mutex` held; closed connections are
+            // moved into `stale` so they can be destroyed after unlocking
+            void retarget(
+                const std::string             & new_parameters,
+                std::vector< idle_connection >& stale
             );
+            // Must be called with `pool_mutex` held
+            void record_acquisition( clock_type::time_point started );
+        };
+        
+        connection_lease connection_pool::acquire(
+            const settings::database_settings& pg_settings
+        )
+        {
+            auto started{ clock_type::now() };
+            auto wanted_parameters{ connection_string( pg_settings ) };
+            auto deadline{
+                started
+                + std::chrono::milliseconds{ pg_settings.pool_acquire_timeout_ms }
+            };
+            std::chrono::milliseconds health_check_after{
+                pg_settings.pool_health_check_idle_ms
+            };
+            
+            while( true )
+            {
+                std::vector< idle_connection > stale;
+                idle_connection candidate;
+                bool open_new{ false };
+                
+                {
+                    std::unique_lock< std::mutex > lock{ pool_mutex };
+                    
+                    if( wanted_parameters != parameters )
+                        retarget( wanted_parameters, stale );
+                    max_open = pg_settings.pool_max_connections;
+                    
+                    if( !available.wait_until( lock, deadline, [ this ]{
+                        return !idle.empty() || open < max_open;
+                    } ) )
+                    {
+                        ++timeouts;
+                        throw pool_timeout{
+                            "timed out waiting for a PostgreSQL connection ("
+                            + std::to_string( in_use )
+                            + " in use)"
+                        };
+                    }
+                    
+                    if( !idle.empty() )
+                    {
+                        candidate = std::move( idle.back() );
+                        idle.pop_back();
+                    }
+                    else
+                    {
+                        ++open;
+                        open_new = true;
+                        candidate.generation = generation;
+                    }
+                    
+                    ++in_use;
+                }
+                
+                if( open_new )
+                    try
+                    {
+                        candidate.connection = open_connection(
+                            wanted_parameters
+                        );
+                    }
+                    catch( ... )
+                    {
+                        {
+                            std::lock_guard< std::mutex > guard{ pool_mutex };
+                            --open;
+                            --in_use;
+                        }
+                        available.notify_one();
+                        throw;
+                    }
+                else if(
+                    started - candidate.since >= health_check_after
+                    && !connection_healthy( *candidate.connection )
+                )
+                {
+                    candidate.connection.reset();
+                    {
+                        std::lock_guard< std::mutex > guard{ pool_mutex };
+                        --open;
+                        --in_use;
+                    }
+                    available.notify_one();
+                    continue;
+                }
+                
+                {
+                    std::lock_guard< std::mutex > guard{ pool_mutex };
+                    if( open_new )
+                        ++created;
+                    record_acquisition( started );
+                }
+                
+                return {
+                    this,
+                    std::move( candidate.connection ),
+                    candidate.generation
+                };
+            }
+        }
+        
+        void connection_pool::release(
+            std::unique_ptr< pqxx::connection >& connection,
+            unsigned long long                   connection_generation
+        )
+        {
+            bool reusable{ connection -> is_open() };
+            
+            {
+                std::lock_guard< std::mutex > guard{ pool_mutex };
+                
+                --in_use;
+                
+                if(
+                    reusable
+                    && connection_generation == generation
+                    && open <= max_open
+                )
+                    idle.push_back( {
+                        std::move( connection ),
+                        connection_generation,
+                        clock_type::now()
+                    } );
+                else
+                    --open;
+            }
+            
+            available.notify_one();
+        }
+        
+        void connection_pool::warm(
+            const settings::database_settings& pg_settings
+        )
+        {
+            auto wanted_parameters{ connection_string( pg_settings ) };
+            
+            while( true )
+            {
+                std::vector< idle_connection > stale;
+                unsigned long long connection_generation;
+                
+                {
+                    std::lock_guard< std::mutex > guard{ pool_mutex };
+                    
+                    if( wanted_parameters != parameters )
+                        retarget( wanted_parameters, stale );
+                    max_open = pg_settings.pool_max_connections;
+                    
+                    if( open >= pg_settings.pool_min_connections )
+                        return;
+                    
+                    ++open;
+                    connection_generation = generation;
+                }
+                
+                try
+                {
+                    auto connection{ open_connection( wanted_parameters ) };
+                    
+                    {
+                        std::lock_guard< std::mutex > guard{ pool_mutex };
+                        ++created;
+                        idle.push_back( {
+                            std::move( connection ),
+                            connection_generation,
+                            clock_type::now()
+                        } );
+                    }
+                    available.notify_one();
+                }
+                catch( ... )
+                {
+                    std::lock_guard< std::mutex > guard{ pool_mutex };
+                    --open;
+                    throw;
+                }
+            }
+        }
+        
+        pool_stats connection_pool::stats() const
+        {
+            std::lock_guard< std::mutex > guard{ pool_mutex };
+            return {
+                open,
+                idle.size(),
+                in_use,
+                created,
+                acquisitions,
+                timeouts,
+                total_wait,
+                max_wait
+            };
+        }
+        
+        void connection_pool::retarget(
+            const std::string             & new_parameters,
+            std::vector< idle_connection >& stale
+        )
+        {
+            parameters = new_parameters;
+            ++generation;
+            
+            open -= idle.size();
+            stale = std::move( idle );
+            idle.clear();
+        }
+        
+        void connection_pool::record_acquisition(
+            clock_type::time_point started
+        )
+        {
+            auto waited{
+                std::chrono::duration_cast< std::chrono::microseconds >(
+                    clock_type::now() - started
+                )
+            };
+            
+            ++acquisitions;
+            total_wait += waited;
+            max_wait    = std::max( max_wait, waited );
+        }
+        
+        connection_lease::connection_lease(
+            connection_pool                    * p,
+            std::unique_ptr< pqxx::connection >&& c,
+            unsigned long long                    g
+        ) :
+            pool      { p              },
+            connection{ std::move( c ) },
+            generation{ g              }
+        {}
+        
+        connection_lease::connection_lease( connection_lease&& o ) :
+            pool      { o.pool                    },
+            connection{ std::move( o.connection ) },
+            generation{ o.generation              }
+        {}
+        
+        connection_lease::~connection_lease()
+        {
+            if( connection )
+                pool -> release( connection, generation );
+        }
+        
+        pqxx::connection& connection_lease::operator *() const
+        {
+            return *connection;
+        }
+        
+        pqxx::connection* connection_lease::operator ->() const
+        {
+            return connection.get();
+        }
+    }
+}
+
+
+namespace
+{
+    stickers::postgres::connection_pool& shared_pool()
+    {
+        static stickers::postgres::connection_pool pool;
+        return pool;
+    }
+    
+    thread_local stickers::postgres::request_context* current_context{
+        nullptr
+    };
+}
+
+
+namespace stickers
+{
+    namespace postgres
+    {
+        statement::statement( std::string n, std::string q ) :
+            name{ std::move( n ) },
+            sql { std::move( q ) }
+        {
+            registered_statements().push_back( this );
+        }
+        
+        bool prepared_statements_enabled()
+        {
+            return current_settings().database.prepared_statements;
+        }
+        
+        bool transaction_open()
+        {
+            return current_context && current_context -> transaction;
+        }
+        
+        request_context::request_context() : previous{ current_context }
+        {
+            current_context = this;
+        }
+        
+        request_context::~request_context()
+        {
+            // Roll back anything left uncommitted before giving up the
+            // connection
+            transaction.reset();
+            current_context = previous;
+        }
+        
+        transaction_scope::transaction_scope()
+        {
+            // Includes any wait for a pooled connection
+            phase_timer timer{ request_phase::DATABASE };
+            
+            if( !current_context )
+                own_context.emplace();
+            context = current_context;
+            
+            owner = !context -> transaction;
+            if( owner )
+            {
+                if( !context -> connection )
+                    context -> connection.emplace( connect() );
+                context -> transaction.emplace( **context -> connection );
+            }
+        }
+        
+        transaction_scope::~transaction_scope()
+        {
+            if( owner )
+            {
+                phase_timer timer{ request_phase::DATABASE };
+                context -> transaction.reset();
+                context -> connection.reset();
+            }
+        }
+        
+        pqxx::work& transaction_scope::operator *() const
+        {
+            return *context -> transaction;
+        }
+        
+        pqxx::work* transaction_scope::operator ->() const
+        {
+            return &*context -> transaction;
+        }
+        
+        void transaction_scope::commit()
+        {
+            if( !owner )
+                return;
+            
+            phase_timer timer{ request_phase::DATABASE };
+            
+            context -> transaction -> commit();
+            context -> transaction.reset();
+            // Nothing needs the connection until the next transaction, so
+            // don't hold it while e.g. the response is sent
+            context -> connection.reset();
+            owner = false;
+        }
+    }
+}
+
+
+namespace stickers
+{
+    namespace postgres
+    {
+        connection_lease connect()
+        {
+            return shared_pool().acquire( current_settings().database );
         }
         
         std::unique_ptr< pqxx::connection > connect(
@@ -33,28 +535,23 @@ namespace stickers
             const std::string& dbname
         )
         {
-            auto connection{ std::make_unique< pqxx::connection >(
-                    "host="    + ( host   == "" ? "''" : host   )
-                + " port="     + std::to_string( port )
-                + " user="     + ( user   == "" ? "''" : user   )
-                + " password=" + ( pass   == "" ? "''" : pass   )
-                + " dbname="   + ( dbname == "" ? "''" : dbname )
-            ) };
-            
-            STICKERS_LOG(
-                log_level::VERBOSE,
-                "created PostgreSQL connection {host=",
-                connection -> hostname(),
-                " port=",
-                connection -> port(),
-                " user=",
-                connection -> username(),
-                " dbname=",
-                connection -> dbname(),
-                "}"
-            );
-            
-            return connection;
+            return open_connection( connection_string(
+                host,
+                port,
+                user,
+                pass,
+                dbname
+            ) );
+        }
+        
+        void warm_connection_pool()
+        {
+            shared_pool().warm( current_settings().database );
+        }
+        
+        pool_stats current_pool_stats()
+        {
+            return shared_pool().stats();
         }
     }
-}
\ No newline at end of file
+}
@@ -3,11 +3,18 @@
 #define STICKERS_MOE_COMMON_POSTGRES_HPP
 
 
+#include "request_timing.hpp"
+
 #define PQXX_HAVE_OPTIONAL
 #include <pqxx/pqxx>
 
+#include <chrono>
+#include <cstddef>  // std::size_t
 #include <memory>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <type_traits> // std::decay_t<>
 
 
 #define PSQL( ... ) #__VA_ARGS__
@@ -17,7 +24,61 @@ namespace stickers
 {
     namespace postgres
     {
-        std::unique_ptr< pqxx::connection > connect();
+        class connection_pool;
+        
+        // A connection borrowed from the pool, returned to it automatically
+        // when the lease is destroyed; use like a pointer to a
+        // `pqxx::connection`
+        class connection_lease
+        {
+            friend class connection_pool;
+        
+        public:
+            connection_lease( connection_lease&& );
+            ~connection_lease();
+            
+            connection_lease( const connection_lease& ) = delete;
+            connection_lease& operator =( const connection_lease& ) = delete;
+            connection_lease& operator =( connection_lease&& ) = delete;
+            
+            pqxx::connection& operator * () const;
+            pqxx::connection* operator ->() const;
+        
+        protected:
+            connection_pool                   * pool;
+            std::unique_ptr< pqxx::connection > connection;
+            unsigned long long                  generation;
+            
+            connection_lease(
+                connection_pool                    *,
+                std::unique_ptr< pqxx::connection >&&,
+                unsigned long long
+            );
+        };
+        
+        struct pool_stats
+        {
+            std::size_t               open;     // Idle + in use + connecting
+            std::size_t               idle;
+            std::size_t               in_use;
+            unsigned long long        created;
+            unsigned long long        acquisitions;
+            unsigned long long        timeouts;
+            std::chrono::microseconds total_wait;
+            std::chrono::microseconds max_wait;
+        };
+        
+        // Thrown when no pooled connection becomes available within the
+        // configured acquire timeout
+        class pool_timeout : public std::runtime_error
+        {
+            using runtime_error::runtime_error;
+        };
+        
+        // Lease a connection from the shared pool using the current database
+        // settings, opening a new one if none are idle and the pool isn't full
+        connection_lease connect();
+        // Open a standalone, unpooled connection
         std::unique_ptr< pqxx::connection > connect(
             const std::string& host,
             unsigned int       port,
@@ -26,31 +87,124 @@ namespace stickers
             const std::string& dbname
         );
         
-        // Format a sequence of query parameters as a comma-separated list which
-        // can then be formatted into a query string surrounded by the
-        // appropriate delimiters (parentheses etc.)
-        template< typename Iterable > std::string format_variable_list(
-            const pqxx::work& transaction,
-            const Iterable  & values
+        // Database state for one request, visible to the current thread for as
+        // long as it exists: the transaction `transaction_scope`s share, and
+        // the connection it runs on, which is leased when the transaction
+        // begins and returned to the pool as soon as it ends
+        class request_context
+        {
+            friend class transaction_scope;
+            friend bool transaction_open();
+        
+        public:
+            request_context();
+            ~request_context();
+            
+            request_context( const request_context& ) = delete;
+            request_context& operator =( const request_context& ) = delete;
+        
+        protected:
+            request_context                 * previous;
+            std::optional< connection_lease > connection;
+            std::optional< pqxx::work       > transaction;
+        };
+        
+        // Whether this thread is inside a `transaction_scope`, and so holds a
+        // pooled connection
+        bool transaction_open();
+        
+        // Joins the current request's transaction, or begins it if none is
+        // open; only the scope that began the transaction actually commits it
+        // or, if destroyed without committing, rolls it back.  Outside of a
+        // `request_context` the scope uses a connection of its own.
+        class transaction_scope
+        {
+        public:
+            transaction_scope();
+            ~transaction_scope();
+            
+            transaction_scope( const transaction_scope& ) = delete;
+            transaction_scope& operator =( const transaction_scope& ) = delete;
+            
+            // Only valid until the transaction is committed
+            pqxx::work& operator * () const;
+            pqxx::work* operator ->() const;
+            
+            void commit();
+        
+        protected:
+            std::optional< request_context > own_context;
+            request_context                * context;
+            bool                             owner;
+        };
+        
+        // A query registered under a unique name so it can be prepared on
+        // every connection when it's opened; define these at namespace scope so
+        // they're all registered before any connections are
+        class statement
+        {
+        public:
+            statement( std::string name, std::string sql );
+            
+            statement( const statement& ) = delete;
+            statement& operator =( const statement& ) = delete;
+            
+            const std::string name;
+            const std::string sql;
+        };
+        
+        // Whether `exec()` uses prepared statements, see `database` config
+        bool prepared_statements_enabled();
+        
+        // Run a registered statement, as a prepared statement unless those are
+        // disabled in which case the query text is sent with the parameters
+        template< typename... Args > pqxx::result exec(
+            pqxx::work     & transaction,
+            const statement& query,
+            const Args&...   args
         )
         {
-            std::string s;
+            phase_timer timer{ request_phase::DATABASE };
             
-            // Use the begin() and end() functions like range-based `for`
-            auto current{ begin( values ) };
-            auto    last{   end( values ) };
+            if( prepared_statements_enabled() )
+                return transaction.exec_prepared( query.name, args... );
+            else
+                return transaction.exec_params( query.sql, args... );
+        }
+        
+        // Open connections up to the configured minimum pool size ahead of
+        // the first requests
+        void warm_connection_pool();
+        pool_stats current_pool_stats();
+        
+        // Format a sequence of values as a PostgreSQL array literal so a whole
+        // list can be passed as a single query parameter, e.g. to
+        // `UNNEST( $1::BIGINT[] )`; the query text stays the same no matter how
+        // many values there are, so it can be prepared
+        template< typename Iterable > std::string format_array_parameter(
+            const Iterable& values
+        )
+        {
+            std::string s{ "{" };
             
-            while( true )
+            for( const auto& value : values )
             {
-                s += transaction.quote( *current );
-                ++current;
-                if( current == last )
-                    break;
-                else
+                if( s.size() > 1 )
                     s += ',';
+                
+                s += '"';
+                for( auto c : pqxx::string_traits<
+                    std::decay_t< decltype( value ) >
+                >::to_string( value ) )
+                {
+                    if( c == '"' || c == '\\' )
+                        s += '\\';
+                    s += c;
+                }
+                s += '"';
             }
             
-            return s;
+            return s + '}';
         }
     }
 }
@@ -0,0 +1,86 @@
+#line 2 "common/request_arena.cpp"
+
+
+#include "request_arena.hpp"
+
+#include <algorithm>    // std::max()
+#include <cstdint>      // std::uintptr_t
+
+
+namespace
+{
+    // Enough for the documents of all but unusually large request bodies
+    constexpr std::size_t default_arena_size{ 16 * 1024 };
+}
+
+
+namespace stickers
+{
+    request_arena::request_arena( std::size_t initial_size ) :
+        first{ nullptr },
+        last { nullptr },
+        next { nullptr },
+        end  { nullptr }
+    {
+        add_block( initial_size );
+        first = last;
+    }
+    
+    request_arena::~request_arena()
+    {
+        reset();
+        ::operator delete( first );
+    }
+    
+    void* request_arena::allocate( std::size_t size, std::size_t alignment )
+    {
+        auto address{ reinterpret_cast< std::uintptr_t >( next ) };
+        auto padding{ ( alignment - address % alignment ) % alignment };
+        
+        if( static_cast< std::size_t >( end - next ) < size + padding )
+        {
+            add_block( size + alignment );
+            return allocate( size, alignment );
+        }
+        
+        auto allocated{ next + padding };
+        next = allocated + size;
+        return allocated;
+    }
+    
+    void request_arena::reset()
+    {
+        while( last != first )
+        {
+            auto previous{ last -> previous };
+            ::operator delete( last );
+            last = previous;
+        }
+        
+        next = reinterpret_cast< char* >( first + 1 );
+        end  = reinterpret_cast< char* >( first ) + first -> size;
+    }
+    
+    void request_arena::add_block( std::size_t minimum_size )
+    {
+        // Blocks double in size so a large request needs few of them
+        auto size{ std::max(
+            minimum_size + sizeof( block ),
+            last ? last -> size * 2 : 0
+        ) };
+        
+        auto added{ static_cast< block* >( ::operator new( size ) ) };
+        added -> previous = last;
+        added -> size     = size;
+        
+        last = added;
+        next = reinterpret_cast< char* >( added + 1 );
+        end  = reinterpret_cast< char* >( added ) + size;
+    }
+    
+    request_arena& current_request_arena()
+    {
+        thread_local request_arena arena{ default_arena_size };
+        return arena;
+    }
+}
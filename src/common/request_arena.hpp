@@ -0,0 +1,114 @@
+#pragma once
+#ifndef STICKERS_MOE_COMMON_REQUEST_ARENA_HPP
+#define STICKERS_MOE_COMMON_REQUEST_ARENA_HPP
+
+
+#include <cstddef>      // std::size_t
+#include <limits>
+#include <new>          // std::bad_array_new_length
+#include <type_traits>  // std::false_type
+
+
+namespace stickers
+{
+    // Bump allocator for memory that lives exactly as long as one request,
+    // such as parsed request documents; deallocating is a no-op, and
+    // `reset()` frees everything at once while keeping the first block around
+    // for the next request
+    class request_arena
+    {
+    public:
+        request_arena( std::size_t initial_size );
+        ~request_arena();
+        
+        request_arena( const request_arena& ) = delete;
+        request_arena& operator =( const request_arena& ) = delete;
+        
+        void* allocate( std::size_t size, std::size_t alignment );
+        void reset();
+    
+    protected:
+        struct block
+        {
+            block     * previous;
+            std::size_t size;       // Including this header
+        };
+        
+        block* first;
+        block* last;
+        char * next;
+        char * end;
+        
+        void add_block( std::size_t minimum_size );
+    };
+    
+    // This thread's arena, reset by the connection worker before each request;
+    // anything allocated from it must not outlive the request
+    request_arena& current_request_arena();
+    
+    // Allocates from a `request_arena`, or from the heap if default-
+    // constructed; copying a container that uses an arena gives a heap-
+    // allocated copy that can outlive the request, while moves keep the arena
+    template< typename T > class arena_allocator
+    {
+        template< typename > friend class arena_allocator;
+    
+    public:
+        using value_type = T;
+        using propagate_on_container_copy_assignment = std::false_type;
+        using propagate_on_container_move_assignment = std::false_type;
+        using propagate_on_container_swap            = std::false_type;
+        
+        arena_allocator() noexcept : arena{ nullptr } {}
+        arena_allocator( request_arena& arena ) noexcept : arena{ &arena } {}
+        template< typename U > arena_allocator(
+            const arena_allocator< U >& other
+        ) noexcept : arena{ other.arena } {}
+        
+        T* allocate( std::size_t count )
+        {
+            if(
+                count > std::numeric_limits< std::size_t >::max() / sizeof( T )
+            )
+                throw std::bad_array_new_length{};
+            else if( arena )
+                return static_cast< T* >( arena -> allocate(
+                    count * sizeof( T ),
+                    alignof( T )
+                ) );
+            else
+                return static_cast< T* >(
+                    ::operator new( count * sizeof( T ) )
+                );
+        }
+        void deallocate( T* pointer, std::size_t ) noexcept
+        {
+            if( !arena )
+                ::operator delete( pointer );
+        }
+        
+        arena_allocator select_on_container_copy_construction() const
+        {
+            return {};
+        }
+        
+        template< typename U > bool operator ==(
+            const arena_allocator< U >& other
+        ) const noexcept
+        {
+            return arena == other.arena;
+        }
+        template< typename U > bool operator !=(
+            const arena_allocator< U >& other
+        ) const noexcept
+        {
+            return arena != other.arena;
+        }
+    
+    protected:
+        request_arena* arena;
+    };
+}
+
+
+#endif
@@ -0,0 +1,46 @@
+#line 2 "common/request_timing.cpp"
+
+
+#include "request_timing.hpp"
+
+
+namespace
+{
+    thread_local stickers::phase_durations durations{};
+    thread_local stickers::phase_timer   * innermost_timer{ nullptr };
+}
+
+
+namespace stickers
+{
+    phase_timer::phase_timer( request_phase phase ) :
+        phase  { phase                            },
+        started{ std::chrono::steady_clock::now() },
+        outer  { innermost_timer                  }
+    {
+        if( outer )
+            durations[ static_cast< std::size_t >( outer -> phase ) ] +=
+                started - outer -> started;
+        innermost_timer = this;
+    }
+    
+    phase_timer::~phase_timer()
+    {
+        auto stopped{ std::chrono::steady_clock::now() };
+        durations[ static_cast< std::size_t >( phase ) ] += stopped - started;
+        
+        if( outer )
+            outer -> started = stopped;
+        innermost_timer = outer;
+    }
+    
+    void reset_request_timings()
+    {
+        durations.fill( std::chrono::steady_clock::duration::zero() );
+    }
+    
+    const phase_durations& current_request_timings()
+    {
+        return durations;
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+#ifndef STICKERS_MOE_COMMON_REQUEST_TIMING_HPP
+#define STICKERS_MOE_COMMON_REQUEST_TIMING_HPP
+
+
+#include <array>
+#include <chrono>
+#include <cstddef>  // std::size_t
+
+
+namespace stickers
+{
+    enum class request_phase : std::size_t
+    {
+        PARSE,
+        AUTHENTICATION,
+        DATABASE,
+        SERIALIZATION
+    };
+    
+    constexpr std::size_t request_phase_count{ 4 };
+    
+    using phase_durations = std::array<
+        std::chrono::steady_clock::duration,
+        request_phase_count
+    >;
+    
+    // Adds the time from construction to destruction to `phase` for the
+    // current thread's request; a timer started while another is running
+    // pauses the outer one, so each phase only counts its own time (e.g.
+    // database queries made while authenticating count as database time)
+    class phase_timer
+    {
+    public:
+        phase_timer( request_phase );
+        ~phase_timer();
+        
+        phase_timer( const phase_timer& ) = delete;
+        phase_timer& operator =( const phase_timer& ) = delete;
+    
+    protected:
+        request_phase                         phase;
+        std::chrono::steady_clock::time_point started;
+        phase_timer                         * outer;
+    };
+    
+    // Zero this thread's phase durations at the start of a request
+    void reset_request_timings();
+    const phase_durations& current_request_timings();
+}
+
+
+#endif
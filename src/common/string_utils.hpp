@@ -4,45 +4,56 @@
 
 
 #include <string>
+#include <string_view>
+#include <vector>
 
 
 namespace stickers
 {
+    // By default the pieces are views into `value`, so are only valid as long
+    // as it is; use e.g. `std::vector< std::string >` for copies
     template<
-        typename CollectionType,
-        typename ValueType
+        typename CollectionType = std::vector< std::string_view >
     > CollectionType split(
-        const ValueType& v,
-        const ValueType& joiner
+        std::string_view value,
+        std::string_view separator
     )
     {
         CollectionType c;
-        auto segment_begin{ v.begin() };
-        for( auto iter = v.begin(); iter != v.end(); ++iter )
+        if( separator.empty() )
         {
-            {
-                auto joiner_candidate_begin{ iter + 1 - joiner.size() };
-                auto joiner_candidate_end  { iter + 1                 };
-                if( ValueType{
-                    joiner_candidate_begin,
-                    joiner_candidate_end
-                } == joiner )
-                {
-                    c.emplace_back( segment_begin, joiner_candidate_begin );
-                    segment_begin = joiner_candidate_end;
-                }
-            }
+            c.emplace_back( value );
+            return c;
         }
-        c.emplace_back( segment_begin, v.end() );
+        
+        std::string_view::size_type segment_begin{ 0 };
+        for(
+            auto found = value.find( separator );
+            found != std::string_view::npos;
+            found = value.find( separator, segment_begin )
+        )
+        {
+            c.emplace_back( value.substr(
+                segment_begin,
+                found - segment_begin
+            ) );
+            segment_begin = found + separator.size();
+        }
+        c.emplace_back( value.substr( segment_begin ) );
         return c;
     }
     
-    template< typename CollectionType, typename ValueType > ValueType join(
+    template< typename CollectionType > std::string join(
         const CollectionType& c,
-        const ValueType     & joiner
+        std::string_view      joiner
     )
     {
-        ValueType v;
+        std::string::size_type size{ 0 };
+        for( const auto& element : c )
+            size += std::string_view{ element }.size() + joiner.size();
+        
+        std::string v;
+        v.reserve( size );
         for( auto iter = c.begin(); iter != c.end(); )
         {
             v += *iter;
@@ -0,0 +1,136 @@
+#line 2 "common/worker_pool.cpp"
+
+
+#include "worker_pool.hpp"
+
+#include "logging.hpp"
+
+#include <exception>
+#include <utility>  // std::move<>()
+
+
+namespace stickers
+{
+    worker_pool::worker_pool(
+        std::size_t worker_count,
+        std::size_t queue_capacity
+    ) :
+        capacity{ queue_capacity },
+        busy    { 0              },
+        stopping{ false          }
+    {
+        // Always have at least one worker, otherwise nothing would ever be
+        // dequeued
+        if( worker_count < 1 )
+            worker_count = 1;
+        
+        workers.reserve( worker_count );
+        try
+        {
+            for( std::size_t i = 0; i < worker_count; ++i )
+                workers.emplace_back( &worker_pool::work, this );
+        }
+        catch( ... )
+        {
+            // The destructor won't run, and destroying a joinable thread
+            // terminates the program
+            stop();
+            throw;
+        }
+    }
+    
+    worker_pool::~worker_pool()
+    {
+        stop();
+    }
+    
+    bool worker_pool::try_enqueue( job_type&& job, std::size_t headroom )
+    {
+        {
+            std::lock_guard< std::mutex > guard{ queue_mutex };
+            if( stopping || queue.size() >= capacity + headroom )
+                return false;
+            queue.emplace_back( std::move( job ) );
+        }
+        queue_condition.notify_one();
+        return true;
+    }
+    
+    std::size_t worker_pool::worker_count() const
+    {
+        return workers.size();
+    }
+    
+    std::size_t worker_pool::busy_count() const
+    {
+        return busy;
+    }
+    
+    std::size_t worker_pool::queue_depth() const
+    {
+        std::lock_guard< std::mutex > guard{ queue_mutex };
+        return queue.size();
+    }
+    
+    std::size_t worker_pool::queue_capacity() const
+    {
+        return capacity;
+    }
+    
+    void worker_pool::stop()
+    {
+        {
+            std::lock_guard< std::mutex > guard{ queue_mutex };
+            stopping = true;
+        }
+        queue_condition.notify_all();
+        
+        for( auto& worker : workers )
+            worker.join();
+    }
+    
+    void worker_pool::work()
+    {
+        while( true )
+        {
+            job_type job;
+            
+            {
+                std::unique_lock< std::mutex > lock{ queue_mutex };
+                queue_condition.wait( lock, [ this ]{
+                    return stopping || !queue.empty();
+                } );
+                
+                // Drain anything still queued before exiting
+                if( queue.empty() )
+                    return;
+                
+                job = std::move( queue.front() );
+                queue.pop_front();
+                ++busy;
+            }
+            
+            try
+            {
+                job();
+            }
+            catch( const std::exception& e )
+            {
+                STICKERS_LOG(
+                    log_level::ERROR,
+                    "uncaught std::exception in worker_pool job: ",
+                    e.what()
+                );
+            }
+            catch( ... )
+            {
+                STICKERS_LOG(
+                    log_level::ERROR,
+                    "uncaught non-std::exception in worker_pool job"
+                );
+            }
+            
+            --busy;
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+#ifndef STICKERS_MOE_COMMON_WORKER_POOL_HPP
+#define STICKERS_MOE_COMMON_WORKER_POOL_HPP
+
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>      // std::size_t
+#include <deque>
+#include <functional>   // std::function
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace stickers
+{
+    // Fixed-size pool of worker threads fed from a bounded FIFO queue; jobs are
+    // rejected rather than queued once the queue is full so callers can shed
+    // load instead of accumulating unbounded backlog
+    class worker_pool
+    {
+    public:
+        using job_type = std::function< void() >;
+        
+        worker_pool( std::size_t worker_count, std::size_t queue_capacity );
+        ~worker_pool();
+        
+        worker_pool( const worker_pool& ) = delete;
+        worker_pool& operator =( const worker_pool& ) = delete;
+        
+        // Returns `false` without taking ownership of the job if the queue is
+        // already at capacity; `headroom` lets the caller allow that many more
+        // jobs when it knows workers are about to free up
+        bool try_enqueue( job_type&&, std::size_t headroom = 0 );
+        
+        std::size_t   worker_count() const;
+        std::size_t     busy_count() const;
+        std::size_t    queue_depth() const;
+        std::size_t queue_capacity() const;
+    
+    protected:
+        mutable std::mutex         queue_mutex;
+        std::condition_variable    queue_condition;
+        std::deque< job_type >     queue;
+        const std::size_t          capacity;
+        std::atomic< std::size_t > busy;
+        bool                       stopping;
+        std::vector< std::thread > workers;
+        
+        // Finishes queued jobs, then joins every started worker
+        void stop();
+        void work();
+    };
+}
+
+
+#endif
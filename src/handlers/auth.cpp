@@ -7,6 +7,7 @@
 #include "../common/auth.hpp"
 #include "../common/config.hpp"
 #include "../common/logging.hpp"
+#include "../common/password_hashing.hpp"
 #include "../server/parse.hpp"
 
 #include <show/constants.hpp>
@@ -62,14 +63,26 @@ namespace stickers
                 content[ "email" ].get< string_document >()
             ) };
             
-            if(
-                user.info.password
-                == content[ "password" ].get< string_document >()
-            )
+            // Checked on the password hashing pool, which throws
+            // `password_hashing_busy` (sent as a 429) when saturated; loading
+            // the user has already given its database connection back
+            const std::string& attempt{
+                content[ "password" ].get< string_document >()
+            };
+            bool password_matches{ false };
+            run_password_hash(
+                [ & ]{
+                    password_matches = user.info.password == attempt;
+                },
+                request.client_address(),
+                static_cast< std::string >( user.id )
+            );
+            
+            if( password_matches )
             {
                 permissions_assert_all(
                     get_user_permissions( user.id ),
-                    { "log_in" }
+                    permission::log_in
                 );
                 
                 auto auth_jwt{ generate_auth_token_for_user(
@@ -91,46 +104,31 @@ namespace stickers
                     request.client_address()
                 );
                 
-                auto token_message_json{ nlj::json{
-                    { "jwt"    , auth_token },
-                    { "user_id", user.id    }
-                }.dump() };
-                
-                show::response response{
-                    request.connection(),
-                    show::HTTP_1_1,
+                send_json_response(
+                    request,
                     show::code::OK,
+                    {
+                        { "jwt"    , auth_token },
+                        { "user_id", user.id    }
+                    },
                     {
                         show::server_header,
                         { "Authorization", {
                             "Bearer " + auth_token
                         } },
-                        { "Content-Type", { "application/json" } },
-                        { "Content-Length", {
-                            std::to_string( token_message_json.size() )
-                        } },
                         { "Location", {
                             "/user/" + static_cast< std::string >( user.id )
                         } },
                         { "Set-Cookie", {
-                            config()[ "auth" ][ "token_cookie_name" ].get<
-                                std::string
-                            >()
+                            current_settings().auth.token_cookie_name
                             + "="
                             + auth_token
                             + "; expires="
                             + to_http_ts_str( *auth_jwt.exp )
                             + "; domain="
-                            + config()[ "auth" ][ "token_cookie_domain" ].get<
-                                std::string
-                            >()
+                            + current_settings().auth.token_cookie_domain
                         } }
                     }
-                };
-                
-                response.sputn(
-                    token_message_json.c_str(),
-                    token_message_json.size()
                 );
                 
                 return;
@@ -81,7 +81,7 @@ namespace
                     + static_cast< std::string >( field )
                     + "\""
                 };
-            else if( !details_map[ field ].is_a< stickers::map_document >() )
+            else if( !details_map[ field ].is_a< stickers::array_document >() )
                 throw stickers::handler_exit{
                     show::code::BAD_REQUEST,
                     "required field \""
@@ -89,21 +89,28 @@ namespace
                     + "\" must be an array"
                 };
         
+        auto& images_array{
+            details_map[ "images" ].get< stickers::array_document >()
+        };
+        auto& contributors_array{
+            details_map[ "contributors" ].get< stickers::array_document >()
+        };
+        
         std::vector< stickers::sha256 > images;
         std::vector< stickers::bigid  > contributors;
+        images      .reserve(       images_array.size() );
+        contributors.reserve( contributors_array.size() );
         
-        for( auto& pair : details_map[ "images" ].get<
-            stickers::map_document
-        >() )
+        for( auto& element : images_array )
             try
             {
                 images.emplace_back(
                     stickers::sha256::from_hex_string(
-                        pair.second.get< stickers::string_document >()
+                        element.get< stickers::string_document >()
                     )
                 );
             }
-            catch( const stickers::hash_error& e )
+            catch( const std::exception& e )
             {
                 throw stickers::handler_exit{
                     show::code::BAD_REQUEST,
@@ -113,18 +120,16 @@ namespace
                     )
                 };
             }
-        for( auto& pair : details_map[ "contributors" ].get<
-            stickers::map_document
-        >() )
+        for( auto& element : contributors_array )
             try
             {
                 contributors.emplace_back(
                     stickers::bigid::from_string(
-                        pair.second.get< stickers::string_document >()
+                        element.get< stickers::string_document >()
                     )
                 );
             }
-            catch( const std::invalid_argument& e )
+            catch( const std::exception& e )
             {
                 throw stickers::handler_exit{
                     show::code::BAD_REQUEST,
@@ -156,7 +161,7 @@ namespace stickers
         auto auth{ authenticate( request ) };
         permissions_assert_all(
             auth.user_permissions,
-            { "edit_public_pages" }
+            permission::edit_public_pages
         );
         
         try
@@ -173,27 +178,17 @@ namespace stickers
             
             nlj::json design_json;
             design_to_json( created.id, created.info, design_json );
-            auto design_json_string{ design_json.dump() };
             
-            show::response response{
-                request.connection(),
-                show::HTTP_1_1,
+            send_json_response(
+                request,
                 show::code::CREATED,
+                design_json,
                 {
                     show::server_header,
-                    { "Content-Type", { "application/json" } },
-                    { "Content-Length", {
-                        std::to_string( design_json_string.size() )
-                    } },
                     { "Location", {
                         "/design/" + static_cast< std::string >( created.id )
                     } }
                 }
-            };
-            
-            response.sputn(
-                design_json_string.c_str(),
-                design_json_string.size()
             );
         }
         catch( const no_such_record_error& e )
@@ -232,24 +227,11 @@ namespace stickers
             
             nlj::json design_json;
             design_to_json( design_id, info, design_json );
-            auto design_json_string{ design_json.dump() };
             
-            show::response response{
-                request.connection(),
-                show::HTTP_1_1,
+            send_json_response(
+                request,
                 show::code::OK,
-                {
-                    show::server_header,
-                    { "Content-Type", { "application/json" } },
-                    { "Content-Length", {
-                        std::to_string( design_json_string.size() )
-                    } }
-                }
-            };
-            
-            response.sputn(
-                design_json_string.c_str(),
-                design_json_string.size()
+                design_json
             );
         }
         catch( const no_such_design& e )
@@ -266,7 +248,7 @@ namespace stickers
         auto auth{ authenticate( request ) };
         permissions_assert_all(
             auth.user_permissions,
-            { "edit_public_pages" }
+            permission::edit_public_pages
         );
         
         auto found_design_id_variable{ variables.find( "design_id" ) };
@@ -307,24 +289,11 @@ namespace stickers
             
             nlj::json design_json;
             design_to_json( design_id, updated_info, design_json );
-            auto design_json_string = design_json.dump();
             
-            show::response response{
-                request.connection(),
-                show::HTTP_1_1,
+            send_json_response(
+                request,
                 show::code::OK,
-                {
-                    show::server_header,
-                    { "Content-Type", { "application/json" } },
-                    { "Content-Length", {
-                        std::to_string( design_json_string.size() )
-                    } }
-                }
-            };
-            
-            response.sputn(
-                design_json_string.c_str(),
-                design_json_string.size()
+                design_json
             );
         }
         catch( const no_such_design& e )
@@ -345,7 +314,7 @@ namespace stickers
         auto auth{ authenticate( request ) };
         permissions_assert_all(
             auth.user_permissions,
-            { "edit_public_pages" }
+            permission::edit_public_pages
         );
         
         auto found_design_id_variable{ variables.find( "design_id" ) };
@@ -379,22 +348,11 @@ namespace stickers
                 }
             );
             
-            std::string null_json{ "null" };
-            
-            show::response response{
-                request.connection(),
-                show::HTTP_1_1,
+            send_json_response(
+                request,
                 show::code::OK,
-                {
-                    show::server_header,
-                    { "Content-Type", { "application/json" } },
-                    { "Content-Length", {
-                        std::to_string( null_json.size() )
-                    } }
-                }
-            };
-            
-            response.sputn( null_json.c_str(), null_json.size() );
+                nullptr
+            );
         }
         catch( const no_such_design& e )
         {
@@ -45,6 +45,8 @@ namespace stickers
         
         void     upload_media( show::request&, const handler_vars_type& );
         void   get_media_info( show::request&, const handler_vars_type& );
+        
+        void      get_metrics( show::request&, const handler_vars_type& );
     }
 }
 
@@ -45,22 +45,11 @@ namespace stickers
                     { "updated" , to_iso8601_str( item.updated ) }
                 } );
             
-            auto list_json{ list.dump() };
-            
-            show::response response{
-                request.connection(),
-                show::HTTP_1_1,
+            send_json_response(
+                request,
                 show::code::OK,
-                {
-                    show::server_header,
-                    { "Content-Type", { "application/json" } },
-                    { "Content-Length", {
-                        std::to_string( list_json.size() )
-                    } }
-                }
-            };
-            
-            response.sputn( list_json.c_str(), list_json.size() );
+                list
+            );
         }
         catch( const no_such_user& nsu )
         {
@@ -8,6 +8,7 @@
 #include "../common/config.hpp"
 #include "../common/json.hpp"
 #include "../common/logging.hpp"
+#include "../server/metrics.hpp"
 #include "../server/parse.hpp"
 
 #include <show/constants.hpp>
@@ -59,7 +60,7 @@ namespace stickers
         auto auth = authenticate( request );
         permissions_assert_all(
             auth.user_permissions,
-            { "edit_public_pages" }
+            permission::edit_public_pages
         );
         
         try
@@ -74,27 +75,19 @@ namespace stickers
                 }
             ) };
             
+            record_upload_bytes( request.content_length() );
+            
             nlj::json media_json;
             media_info_to_json( uploaded.file_hash, uploaded.info, media_json );
-            auto media_json_string{ media_json.dump() };
             
-            show::response response{
-                request.connection(),
-                show::HTTP_1_1,
+            send_json_response(
+                request,
                 show::code::CREATED,
+                media_json,
                 {
                     show::server_header,
-                    { "Content-Type", { "application/json" } },
-                    { "Content-Length", {
-                        std::to_string( media_json_string.size() )
-                    } },
                     { "Location", { uploaded.info.file_url } }
                 }
-            };
-            
-            response.sputn(
-                media_json_string.c_str(),
-                media_json_string.size()
             );
         }
         catch( const indeterminate_mime_type& e )
@@ -132,24 +125,11 @@ namespace stickers
             
             nlj::json media_json;
             media_info_to_json( hash, info, media_json );
-            auto media_json_string{ media_json.dump() };
             
-            show::response response{
-                request.connection(),
-                show::HTTP_1_1,
+            send_json_response(
+                request,
                 show::code::OK,
-                {
-                    show::server_header,
-                    { "Content-Type", { "application/json" } },
-                    { "Content-Length", {
-                        std::to_string( media_json_string.size() )
-                    } }
-                }
-            };
-            
-            response.sputn(
-                media_json_string.c_str(),
-                media_json_string.size()
+                media_json
             );
         }
         catch( const hash_error& e )
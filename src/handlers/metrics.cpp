@@ -0,0 +1,44 @@
+#line 2 "handlers/metrics.cpp"
+
+
+#include "handlers.hpp"
+
+#include "../common/auth.hpp"
+#include "../server/access_log.hpp"
+#include "../server/metrics.hpp"
+
+#include <show/constants.hpp>
+
+
+namespace stickers
+{
+    void handlers::get_metrics(
+        show::request& request,
+        const handler_vars_type& variables
+    )
+    {
+        // Latencies, error rates, & pool saturation aren't for the public
+        auto auth{ authenticate( request ) };
+        permissions_assert_all(
+            auth.user_permissions,
+            permission::view_metrics
+        );
+        
+        auto metrics{ format_metrics() };
+        
+        show::response response{
+            request.connection(),
+            show::HTTP_1_1,
+            show::code::OK,
+            {
+                show::server_header,
+                { "Content-Type", { "text/plain; version=0.0.4" } },
+                { "Content-Length", { std::to_string( metrics.size() ) } }
+            }
+        };
+        
+        response.sputn( metrics.c_str(), metrics.size() );
+        
+        note_response( show::code::OK, metrics.size() );
+    }
+}
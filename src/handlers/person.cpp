@@ -132,7 +132,7 @@ namespace stickers
         auto auth{ authenticate( request ) };
         permissions_assert_all(
             auth.user_permissions,
-            { "edit_public_pages" }
+            permission::edit_public_pages
         );
         
         try
@@ -149,27 +149,17 @@ namespace stickers
             
             nlj::json person_json;
             person_to_json( created.id, created.info, person_json );
-            auto person_json_string{ person_json.dump() };
             
-            show::response response{
-                request.connection(),
-                show::HTTP_1_1,
+            send_json_response(
+                request,
                 show::code::CREATED,
+                person_json,
                 {
                     show::server_header,
-                    { "Content-Type", { "application/json" } },
-                    { "Content-Length", {
-                        std::to_string( person_json_string.size() )
-                    } },
                     { "Location", {
                         "/person/" + static_cast< std::string >( created.id )
                     } }
                 }
-            };
-            
-            response.sputn(
-                person_json_string.c_str(),
-                person_json_string.size()
             );
         }
         catch( const no_such_record_error& e )
@@ -208,24 +198,11 @@ namespace stickers
             
             nlj::json person_json;
             person_to_json( person_id, info, person_json );
-            auto person_json_string{ person_json.dump() };
             
-            show::response response{
-                request.connection(),
-                show::HTTP_1_1,
+            send_json_response(
+                request,
                 show::code::OK,
-                {
-                    show::server_header,
-                    { "Content-Type", { "application/json" } },
-                    { "Content-Length", {
-                        std::to_string( person_json_string.size() )
-                    } }
-                }
-            };
-            
-            response.sputn(
-                person_json_string.c_str(),
-                person_json_string.size()
+                person_json
             );
         }
         catch( const no_such_person& e )
@@ -242,7 +219,7 @@ namespace stickers
         auto auth{ authenticate( request ) };
         permissions_assert_all(
             auth.user_permissions,
-            { "edit_public_pages" }
+            permission::edit_public_pages
         );
         
         auto found_person_id_variable{ variables.find( "person_id" ) };
@@ -283,24 +260,11 @@ namespace stickers
             
             nlj::json person_json;
             person_to_json( person_id, updated_info, person_json );
-            auto person_json_string{ person_json.dump() };
             
-            show::response response{
-                request.connection(),
-                show::HTTP_1_1,
+            send_json_response(
+                request,
                 show::code::OK,
-                {
-                    show::server_header,
-                    { "Content-Type", { "application/json" } },
-                    { "Content-Length", {
-                        std::to_string( person_json_string.size() )
-                    } }
-                }
-            };
-            
-            response.sputn(
-                person_json_string.c_str(),
-                person_json_string.size()
+                person_json
             );
         }
         catch( const no_such_person& e )
@@ -321,7 +285,7 @@ namespace stickers
         auto auth{ authenticate( request ) };
         permissions_assert_all(
             auth.user_permissions,
-            { "edit_public_pages" }
+            permission::edit_public_pages
         );
         
         auto found_person_id_variable{ variables.find( "person_id" ) };
@@ -355,22 +319,11 @@ namespace stickers
                 }
             );
             
-            std::string null_json{ "null" };
-            
-            show::response response{
-                request.connection(),
-                show::HTTP_1_1,
+            send_json_response(
+                request,
                 show::code::OK,
-                {
-                    show::server_header,
-                    { "Content-Type", { "application/json" } },
-                    { "Content-Length", {
-                        std::to_string( null_json.size() )
-                    } }
-                }
-            };
-            
-            response.sputn( null_json.c_str(), null_json.size() );
+                nullptr
+            );
         }
         catch( const no_such_person& e )
         {
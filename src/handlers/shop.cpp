@@ -179,7 +179,7 @@ namespace stickers
         auto auth{ authenticate( request ) };
         permissions_assert_all(
             auth.user_permissions,
-            { "edit_public_pages" }
+            permission::edit_public_pages
         );
         
         try
@@ -196,27 +196,17 @@ namespace stickers
             
             nlj::json shop_json;
             shop_to_json( created.id, created.info, shop_json );
-            auto shop_json_string{ shop_json.dump() };
             
-            show::response response{
-                request.connection(),
-                show::HTTP_1_1,
+            send_json_response(
+                request,
                 show::code::CREATED,
+                shop_json,
                 {
                     show::server_header,
-                    { "Content-Type", { "application/json" } },
-                    { "Content-Length", {
-                        std::to_string( shop_json_string.size() )
-                    } },
                     { "Location", {
                         "/shop/" + static_cast< std::string >( created.id )
                     } }
                 }
-            };
-            
-            response.sputn(
-                shop_json_string.c_str(),
-                shop_json_string.size()
             );
         }
         catch( const no_such_record_error& e )
@@ -255,24 +245,11 @@ namespace stickers
             
             nlj::json shop_json;
             shop_to_json( shop_id, info, shop_json );
-            auto shop_json_string{ shop_json.dump() };
             
-            show::response response{
-                request.connection(),
-                show::HTTP_1_1,
+            send_json_response(
+                request,
                 show::code::OK,
-                {
-                    show::server_header,
-                    { "Content-Type", { "application/json" } },
-                    { "Content-Length", {
-                        std::to_string( shop_json_string.size() )
-                    } }
-                }
-            };
-            
-            response.sputn(
-                shop_json_string.c_str(),
-                shop_json_string.size()
+                shop_json
             );
         }
         catch( const no_such_shop& e )
@@ -289,7 +266,7 @@ namespace stickers
         auto auth{ authenticate( request ) };
         permissions_assert_all(
             auth.user_permissions,
-            { "edit_public_pages" }
+            permission::edit_public_pages
         );
         
         auto found_shop_id_variable{ variables.find( "shop_id" ) };
@@ -328,24 +305,11 @@ namespace stickers
             
             nlj::json shop_json;
             shop_to_json( shop_id, updated_info, shop_json );
-            auto shop_json_string = shop_json.dump();
             
-            show::response response{
-                request.connection(),
-                show::HTTP_1_1,
+            send_json_response(
+                request,
                 show::code::OK,
-                {
-                    show::server_header,
-                    { "Content-Type", { "application/json" } },
-                    { "Content-Length", {
-                        std::to_string( shop_json_string.size() )
-                    } }
-                }
-            };
-            
-            response.sputn(
-                shop_json_string.c_str(),
-                shop_json_string.size()
+                shop_json
             );
         }
         catch( const no_such_shop& e )
@@ -366,7 +330,7 @@ namespace stickers
         auto auth{ authenticate( request ) };
         permissions_assert_all(
             auth.user_permissions,
-            { "edit_public_pages" }
+            permission::edit_public_pages
         );
         
         auto found_shop_id_variable{ variables.find( "shop_id" ) };
@@ -400,22 +364,11 @@ namespace stickers
                 }
             );
             
-            std::string null_json{ "null" };
-            
-            show::response response{
-                request.connection(),
-                show::HTTP_1_1,
+            send_json_response(
+                request,
                 show::code::OK,
-                {
-                    show::server_header,
-                    { "Content-Type", { "application/json" } },
-                    { "Content-Length", {
-                        std::to_string( null_json.size() )
-                    } }
-                }
-            };
-            
-            response.sputn( null_json.c_str(), null_json.size() );
+                nullptr
+            );
         }
         catch( const no_such_shop& e )
         {
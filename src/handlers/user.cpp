@@ -26,7 +26,7 @@ namespace stickers
         auto auth{ authenticate( request ) };
         permissions_assert_all(
             auth.user_permissions,
-            { "create_user" }
+            permission::create_user
         );
         
         auto details_doc{ parse_request_content( request ) };
@@ -68,6 +68,8 @@ namespace stickers
         
         try
         {
+            // Not inside a transaction, as the password is hashed first and no
+            // connection should be held while waiting for that
             auto created_user{ create_user(
                 details,
                 {
@@ -98,25 +100,17 @@ namespace stickers
             else
                 details_json[ "avatar" ] = nullptr;
             
-            auto user_json{ details_json.dump() };
-            
-            show::response response{
-                request.connection(),
-                show::HTTP_1_1,
+            send_json_response(
+                request,
                 show::code::CREATED,
+                details_json,
                 {
                     show::server_header,
-                    { "Content-Type", { "application/json" } },
-                    { "Content-Length", {
-                        std::to_string( user_json.size() )
-                    } },
                     { "Location", {
                         "/user/" + static_cast< std::string >( created_user.id )
                     } }
                 }
-            };
-            
-            response.sputn( user_json.c_str(), user_json.size() );
+            );
         }
         catch( const no_such_record_error& e )
         {
@@ -167,22 +161,11 @@ namespace stickers
             else
                 user_json[ "avatar" ] = nullptr;
             
-            auto user_json_string = user_json.dump();
-            
-            show::response response{
-                request.connection(),
-                show::HTTP_1_1,
+            send_json_response(
+                request,
                 show::code::OK,
-                {
-                    show::server_header,
-                    { "Content-Type", { "application/json" } },
-                    { "Content-Length", {
-                        std::to_string( user_json_string.size() )
-                    } }
-                }
-            };
-            
-            response.sputn( user_json_string.c_str(), user_json_string.size() );
+                user_json
+            );
         }
         catch( const no_such_user& e )
         {
@@ -215,12 +198,12 @@ namespace stickers
         if( auth.user_id == user_id )
             permissions_assert_all(
                 auth.user_permissions,
-                { "edit_own_user" }
+                permission::edit_own_user
             );
         else
             permissions_assert_all(
                 auth.user_permissions,
-                { "edit_any_user" }
+                permission::edit_any_user
             );
         
         try
@@ -265,12 +248,12 @@ namespace stickers
         if( auth.user_id == user_id )
             permissions_assert_all(
                 auth.user_permissions,
-                { "delete_own_user" }
+                permission::delete_own_user
             );
         else
             permissions_assert_all(
                 auth.user_permissions,
-                { "delete_any_user" }
+                permission::delete_any_user
             );
         
         try
@@ -285,22 +268,11 @@ namespace stickers
                 }
             );
             
-            std::string null_json = "null";
-            
-            show::response response{
-                request.connection(),
-                show::HTTP_1_1,
+            send_json_response(
+                request,
                 show::code::OK,
-                {
-                    show::server_header,
-                    { "Content-Type", { "application/json" } },
-                    { "Content-Length", {
-                        std::to_string( null_json.size() )
-                    } }
-                }
-            };
-            
-            response.sputn( null_json.c_str(), null_json.size() );
+                nullptr
+            );
         }
         catch( const no_such_user& nsu )
         {
@@ -0,0 +1,293 @@
+#line 2 "server/access_log.cpp"
+
+
+#include "access_log.hpp"
+
+#include "../common/config.hpp"
+#include "../common/json.hpp"
+#include "../common/logging.hpp"
+#include "../common/timestamp.hpp"
+
+#include <algorithm>  // std::find()
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <memory>     // std::shared_ptr
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace
+{
+    thread_local unsigned short noted_status_code{ 0 };
+    thread_local std::size_t    noted_size       { 0 };
+    
+    long long microseconds( std::chrono::steady_clock::duration d )
+    {
+        return std::chrono::duration_cast< std::chrono::microseconds >(
+            d
+        ).count();
+    }
+    
+    // Lines waiting to be written by one thread; only that thread appends to
+    // it, so its lock is only ever contended by the flusher swapping it out
+    struct pending_lines
+    {
+        std::mutex          mutex;
+        std::string         lines;
+        unsigned long long  dropped { 0     };
+        // Set once the owning thread has exited, after which the buffer can be
+        // discarded as soon as it's been flushed
+        std::atomic< bool > orphaned{ false };
+    };
+    
+    // Lines past this are dropped (counted & reported) rather than letting a
+    // stalled flusher grow a thread's buffer without bound
+    const std::size_t max_pending_bytes{ 1024 * 1024 };
+    
+    // Workers append lines to their own buffers; a background thread takes
+    // each buffer's contents about once a second and writes them out, so
+    // workers never wait on each other or on the disk
+    class access_log_file
+    {
+    public:
+        access_log_file() :
+            stopping{ false },
+            flusher { &access_log_file::flush_loop, this }
+        {}
+        
+        ~access_log_file()
+        {
+            {
+                std::lock_guard< std::mutex > lock{ stop_mutex };
+                stopping = true;
+            }
+            stop_condition.notify_one();
+            flusher.join();
+        }
+        
+        access_log_file( const access_log_file& ) = delete;
+        access_log_file& operator =( const access_log_file& ) = delete;
+        
+        std::shared_ptr< pending_lines > add_buffer()
+        {
+            auto buffer{ std::make_shared< pending_lines >() };
+            std::lock_guard< std::mutex > lock{ buffers_mutex };
+            buffers.push_back( buffer );
+            return buffer;
+        }
+    
+    protected:
+        std::mutex                                      buffers_mutex;
+        std::vector< std::shared_ptr< pending_lines > > buffers;
+        
+        std::mutex              stop_mutex;
+        std::condition_variable stop_condition;
+        bool                    stopping;
+        
+        // Only touched by the flusher thread
+        std::ofstream file;
+        std::string   file_path;
+        
+        // Declared last so everything it uses exists before it starts
+        std::thread flusher;
+        
+        void flush_loop()
+        {
+            while( true )
+            {
+                bool stop;
+                {
+                    std::unique_lock< std::mutex > lock{ stop_mutex };
+                    stop = stop_condition.wait_for(
+                        lock,
+                        std::chrono::seconds{ 1 },
+                        [ this ]{ return stopping; }
+                    );
+                }
+                
+                flush();
+                
+                if( stop )
+                    return;
+            }
+        }
+        
+        void flush()
+        {
+            std::vector< std::shared_ptr< pending_lines > > current_buffers;
+            {
+                std::lock_guard< std::mutex > lock{ buffers_mutex };
+                current_buffers = buffers;
+            }
+            
+            std::string        lines;
+            std::string        taken;
+            unsigned long long dropped{ 0 };
+            std::vector< std::shared_ptr< pending_lines > > finished;
+            
+            for( auto& buffer : current_buffers )
+            {
+                // Checked first, so nothing can be appended after the swap
+                bool orphaned{ buffer -> orphaned };
+                {
+                    std::lock_guard< std::mutex > lock{ buffer -> mutex };
+                    taken.swap( buffer -> lines );
+                    dropped += buffer -> dropped;
+                    buffer -> dropped = 0;
+                }
+                lines += taken;
+                taken.clear();
+                
+                if( orphaned )
+                    finished.push_back( buffer );
+            }
+            
+            if( !finished.empty() )
+            {
+                std::lock_guard< std::mutex > lock{ buffers_mutex };
+                for( auto& buffer : finished )
+                    buffers.erase( std::find(
+                        buffers.begin(),
+                        buffers.end(),
+                        buffer
+                    ) );
+            }
+            
+            if( dropped )
+                STICKERS_LOG(
+                    stickers::log_level::WARNING,
+                    "access log buffers full, dropped ",
+                    dropped,
+                    " records"
+                );
+            
+            if( lines.empty() )
+                return;
+            
+            // Reopened whenever the config names a different file, so the log
+            // can be rotated by changing the path and reloading the config
+            stickers::refresh_config();
+            auto& path{ stickers::current_settings().server.access_log };
+            if( path.empty() )
+                return;
+            if( path != file_path )
+            {
+                file.close();
+                file.clear();
+                file.open( path, std::ios::out | std::ios::app );
+                file_path = path;
+                
+                if( !file )
+                    STICKERS_LOG(
+                        stickers::log_level::ERROR,
+                        "could not open access log ",
+                        path
+                    );
+            }
+            
+            if( !file )
+                return;
+            
+            file << lines;
+            file.flush();
+        }
+    };
+    
+    access_log_file& shared_access_log()
+    {
+        static access_log_file log;
+        return log;
+    }
+    
+    struct pending_lines_owner
+    {
+        std::shared_ptr< pending_lines > buffer;
+        
+        ~pending_lines_owner()
+        {
+            if( buffer )
+                buffer -> orphaned = true;
+        }
+    };
+    
+    thread_local pending_lines_owner local_lines;
+    
+    void append_line( const std::string& line )
+    {
+        if( !local_lines.buffer )
+            local_lines.buffer = shared_access_log().add_buffer();
+        
+        auto& buffer{ *local_lines.buffer };
+        std::lock_guard< std::mutex > lock{ buffer.mutex };
+        
+        if( buffer.lines.size() + line.size() >= max_pending_bytes )
+        {
+            ++buffer.dropped;
+            return;
+        }
+        
+        buffer.lines += line;
+        buffer.lines += '\n';
+    }
+}
+
+
+namespace stickers
+{
+    void note_response(
+        const show::response_code& code,
+        std::size_t                bytes_out
+    )
+    {
+        noted_status_code = code.code;
+        noted_size        = bytes_out;
+    }
+    
+    void clear_noted_response()
+    {
+        noted_status_code = 0;
+        noted_size        = 0;
+    }
+    
+    unsigned short noted_status()
+    {
+        return noted_status_code;
+    }
+    
+    std::size_t noted_bytes_out()
+    {
+        return noted_size;
+    }
+    
+    void write_access_record( const access_record& record )
+    {
+        auto& path{ current_settings().server.access_log };
+        if( path.empty() )
+            return;
+        
+        auto phase_us{ [ &record ]( request_phase phase ){
+            return microseconds(
+                record.phases[ static_cast< std::size_t >( phase ) ]
+            );
+        } };
+        
+        nlj::json record_json{
+            { "time"        , to_iso8601_str( now() )                   },
+            { "method"      , record.method                             },
+            { "route"       , record.route                              },
+            { "status"      , record.status                             },
+            { "bytes_in"    , record.bytes_in                           },
+            { "bytes_out"   , record.bytes_out                          },
+            { "client"      , record.client                             },
+            { "total_us"    , microseconds( record.total )              },
+            { "parse_us"    , phase_us( request_phase::PARSE          ) },
+            { "auth_us"     , phase_us( request_phase::AUTHENTICATION ) },
+            { "database_us" , phase_us( request_phase::DATABASE       ) },
+            { "serialize_us", phase_us( request_phase::SERIALIZATION  ) }
+        };
+        
+        append_line( record_json.dump() );
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+#ifndef STICKERS_MOE_SERVER_ACCESS_LOG_HPP
+#define STICKERS_MOE_SERVER_ACCESS_LOG_HPP
+
+
+#include "../common/request_timing.hpp"
+
+#include <show.hpp>
+
+#include <chrono>
+#include <cstddef>  // std::size_t
+#include <string>
+
+
+namespace stickers
+{
+    // One line of the access log, written after each routed request
+    struct access_record
+    {
+        std::string                         method;
+        std::string                         route;      // Path template
+        std::string                         client;
+        unsigned short                      status;     // 0 if nothing was sent
+        unsigned long long                  bytes_in;
+        std::size_t                         bytes_out;
+        std::chrono::steady_clock::duration total;
+        phase_durations                     phases;
+    };
+    
+    // Remember the response sent for the current thread's request so it can be
+    // included in the request's access record
+    void note_response( const show::response_code&, std::size_t bytes_out );
+    void clear_noted_response();
+    unsigned short noted_status();
+    std::size_t    noted_bytes_out();
+    
+    // Append the record as one line of JSON to the file named by the `server`
+    // config's `access_log` setting; does nothing if that's empty.  Lines are
+    // buffered per thread & written out by a background thread.
+    void write_access_record( const access_record& );
+}
+
+
+#endif
@@ -3,20 +3,54 @@
 #define STICKERS_MOE_SERVER_HANDLER_HPP
 
 
+#include "../common/json.hpp"
+
 #include <show.hpp>
 
-#include <functional>   // std::function
-#include <map>
+#include <array>
+#include <cstddef>      // std::size_t
+#include <string>
+#include <string_view>
+#include <utility>      // std::pair<>, std::move<>()
 
 
 namespace stickers
 {
-    using handler_vars_type = std::map< std::string, std::string >;
+    // Path variables captured while routing, by name; no route has more than a
+    // few so they're stored inline and searched linearly instead of in a map
+    class handler_vars_type
+    {
+    public:
+        // Names point into the route table, which lives as long as the server
+        using value_type = std::pair< std::string_view, std::string >;
+        
+        static constexpr std::size_t capacity{ 4 };
+        
+        const value_type* begin() const { return vars.data();         }
+        const value_type*   end() const { return vars.data() + count; }
+        
+        std::size_t size() const { return count; }
+        
+        const value_type* find( std::string_view name ) const
+        {
+            auto found{ begin() };
+            while( found != end() && found -> first != name )
+                ++found;
+            return found;
+        }
+        
+        // The route table guarantees no route has more than `capacity`
+        void add( std::string_view name, std::string value )
+        {
+            vars[ count++ ] = { name, std::move( value ) };
+        }
     
-    using handler_type = std::function< void(
-        show::request&,
-        const handler_vars_type&
-    ) >;
+    protected:
+        std::array< value_type, capacity > vars;
+        std::size_t                        count{ 0 };
+    };
+    
+    using handler_type = void (*)( show::request&, const handler_vars_type& );
     
     class handler_exit
     {
@@ -32,6 +66,16 @@ namespace stickers
             message      { message       }
         {}
     };
+    
+    // Serialize `body` and send it as the whole response, noting the status and
+    // size for the access log; `Content-Type` and `Content-Length` are added to
+    // `headers`
+    void send_json_response(
+        show::request      & request,
+        show::response_code  code,
+        const nlj::json    & body,
+        show::headers_type   headers = { show::server_header }
+    );
 }
 
 
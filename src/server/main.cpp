@@ -3,13 +3,60 @@
 
 #include "server.hpp"
 #include "../common/config.hpp"
-#include "../common/json.hpp"
 #include "../common/logging.hpp"
 
-#include <fstream>
 #include <iostream>
 #include <cstdlib>  // std::srand()
 #include <ctime>    // std::time()
+#include <string>
+#include <thread>
+
+#include <signal.h> // sigwait(), pthread_sigmask()
+
+
+namespace
+{
+    // Waits for SIGHUP and re-reads the config file each time one arrives; a
+    // config that fails to load or validate is logged and the running config
+    // kept
+    void reload_config_on_sighup( std::string config_file )
+    {
+        sigset_t reload_signals;
+        sigemptyset( &reload_signals );
+        sigaddset( &reload_signals, SIGHUP );
+        
+        while( true )
+        {
+            int signal;
+            if( sigwait( &reload_signals, &signal ) != 0 )
+                continue;
+            
+            STICKERS_LOG(
+                stickers::log_level::INFO,
+                "received SIGHUP, reloading config file ",
+                config_file
+            );
+            
+            try
+            {
+                stickers::open_config( config_file );
+                STICKERS_LOG(
+                    stickers::log_level::INFO,
+                    "reloaded config file ",
+                    config_file
+                );
+            }
+            catch( const std::exception& e )
+            {
+                STICKERS_LOG(
+                    stickers::log_level::ERROR,
+                    "config reload failed, keeping current config: ",
+                    e.what()
+                );
+            }
+        }
+    }
+}
 
 
 int main( int argc, char* argv[] )
@@ -27,39 +74,31 @@ int main( int argc, char* argv[] )
     
     std::srand( std::time( nullptr ) );
     
+    // Block SIGHUP before any other threads are started so they all inherit
+    // the mask and only the reload thread ever receives it
+    sigset_t reload_signals;
+    sigemptyset( &reload_signals );
+    sigaddset( &reload_signals, SIGHUP );
+    pthread_sigmask( SIG_BLOCK, &reload_signals, nullptr );
+    
     try
     {
+        try
         {
-            nlj::json config;
-            std::ifstream config_file{ argv[ 1 ] };
-            
-            if( config_file.is_open() )
-            {
-                config_file >> config;
-                if( !config_file.good() )
-                {
-                    STICKERS_LOG(
-                        stickers::log_level::ERROR,
-                        "config file ",
-                        argv[ 1 ],
-                        " not a valid JSON file"
-                    );
-                    return -1;
-                }
-            }
-            else
-            {
-                STICKERS_LOG(
-                    stickers::log_level::ERROR,
-                    "could not open config file ",
-                    argv[ 1 ]
-                );
-                return -1;
-            }
-            
-            stickers::set_config( config );
+            stickers::open_config( argv[ 1 ] );
+        }
+        catch( const stickers::config_error& e )
+        {
+            STICKERS_LOG(
+                stickers::log_level::ERROR,
+                "could not load config: ",
+                e.what()
+            );
+            return -1;
         }
         
+        std::thread{ reload_config_on_sighup, std::string{ argv[ 1 ] } }.detach();
+        
         stickers::run_server();
     }
     catch( const std::exception &e )
@@ -0,0 +1,528 @@
+#line 2 "server/metrics.cpp"
+
+
+#include "metrics.hpp"
+
+#include "server.hpp"
+#include "../common/postgres.hpp"
+
+#include <algorithm>    // std::min()
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>        // std::tie()
+#include <vector>
+
+
+namespace // Shards ////////////////////////////////////////////////////////////
+{
+    using counter_type = std::atomic< unsigned long long >;
+    
+    // Threads are spread round-robin over a fixed number of shards rather than
+    // each getting their own, so the set of shards never changes; with the
+    // default worker count few threads ever share one
+    constexpr std::size_t shard_count{ 16 };
+    
+    std::size_t this_thread_shard()
+    {
+        static std::atomic< std::size_t > next_shard{ 0 };
+        thread_local std::size_t shard{ next_shard++ % shard_count };
+        return shard;
+    }
+    
+    // Latency buckets are log-linear like an HDR histogram, two per doubling
+    // from 64us up to ~67s plus one for anything longer, so a bucket's bound
+    // is never more than 50% above the latencies counted in it
+    constexpr std::size_t bucket_count{ 42 };
+    
+    std::size_t bucket_index( unsigned long long us )
+    {
+        if( us <= 64 )
+            return 0;
+        
+        // Bucket bounds are inclusive, so work with `us - 1`
+        auto w{ us - 1 };
+        std::size_t doubling{ 63u - __builtin_clzll( w ) };     // >= 6
+        std::size_t index{
+            ( doubling - 6 ) * 2 + ( ( w >> ( doubling - 1 ) ) & 1 ) + 1
+        };
+        
+        return std::min( index, bucket_count - 1 );
+    }
+    
+    // Inclusive upper bound of every bucket but the last
+    unsigned long long bucket_bound_us( std::size_t index )
+    {
+        if( index == 0 )
+            return 64;
+        
+        auto doubling{ ( index - 1 ) / 2 + 6 };
+        auto half    { ( index - 1 ) % 2     };
+        return (
+            ( 1ull << doubling )
+            + ( half + 1 ) * ( 1ull << ( doubling - 1 ) )
+        );
+    }
+    
+    // Aligned so shards used by different threads don't share cache lines
+    struct alignas( 64 ) series_shard
+    {
+        std::array< counter_type, bucket_count > buckets;
+        counter_type                             total_us;
+        counter_type                             bytes_in;
+        counter_type                             bytes_out;
+    };
+    
+    struct alignas( 64 ) counter_shard
+    {
+        counter_type value;
+    };
+    
+    using series = std::array< series_shard, shard_count >;
+    
+    std::array< counter_shard, shard_count > upload_bytes{};
+    
+    unsigned long long relaxed_add( counter_type& c, unsigned long long n )
+    {
+        return c.fetch_add( n, std::memory_order_relaxed );
+    }
+    
+    unsigned long long relaxed_load( const counter_type& c )
+    {
+        return c.load( std::memory_order_relaxed );
+    }
+}
+
+
+namespace // Series ////////////////////////////////////////////////////////////
+{
+    struct series_key
+    {
+        std::string    method;
+        std::string    route;
+        unsigned short status;
+        
+        bool operator <( const series_key& o ) const
+        {
+            return (
+                std::tie(   method,   route,   status )
+                < std::tie( o.method, o.route, o.status )
+            );
+        }
+    };
+    
+    // Series are created on first use and never removed, so the pointers each
+    // thread caches stay valid; the lock is only taken for a thread's first
+    // request with a given key and while scraping
+    class series_registry
+    {
+    public:
+        series& find_or_create( const series_key& key )
+        {
+            std::lock_guard< std::mutex > lock{ registry_mutex };
+            
+            auto& found{ all_series[ key ] };
+            if( !found )
+                found = std::make_unique< series >();   // Zeroed
+            return *found;
+        }
+        
+        template< typename Function > void for_each( Function f )
+        {
+            std::lock_guard< std::mutex > lock{ registry_mutex };
+            for( auto& [ key, s ] : all_series )
+                f( key, *s );
+        }
+    
+    protected:
+        std::mutex                                      registry_mutex;
+        std::map< series_key, std::unique_ptr< series > > all_series;
+    };
+    
+    series_registry& shared_registry()
+    {
+        static series_registry registry;
+        return registry;
+    }
+    
+    // Methods come straight from clients, so anything unusual is counted
+    // together to keep the number of series bounded
+    std::string method_label( const std::optional< stickers::http_method >& m )
+    {
+        return m ? stickers::http_method_name( *m ) : "other";
+    }
+    
+    // Key for a thread's cached series pointers; a route template is fully
+    // determined by the node and whether it matched the whole path
+    struct cached_series_key
+    {
+        const stickers::route_table::node* node;
+        bool                               found;
+        std::size_t                        method;  // Or `http_method_count`
+        unsigned short                     status;
+        
+        bool operator <( const cached_series_key& o ) const
+        {
+            return (
+                std::tie(   node,   found,   method,   status )
+                < std::tie( o.node, o.found, o.method, o.status )
+            );
+        }
+    };
+    
+    series_shard& this_thread_series_shard(
+        const stickers::routed_request& routed,
+        const stickers::access_record & record
+    )
+    {
+        thread_local std::map< cached_series_key, series* > cached_series;
+        
+        cached_series_key cache_key{
+            routed.node,
+            routed.found,
+            (
+                routed.method
+                ? static_cast< std::size_t >( *routed.method )
+                : stickers::http_method_count
+            ),
+            record.status
+        };
+        
+        auto cached{ cached_series.find( cache_key ) };
+        if( cached == cached_series.end() )
+            cached = cached_series.emplace(
+                cache_key,
+                &shared_registry().find_or_create( {
+                    method_label( routed.method ),
+                    record.route,
+                    record.status
+                } )
+            ).first;
+        
+        return ( *cached -> second )[ this_thread_shard() ];
+    }
+}
+
+
+namespace // Formatting ////////////////////////////////////////////////////////
+{
+    // One series' shards summed
+    struct series_totals
+    {
+        std::array< unsigned long long, bucket_count > buckets;
+        unsigned long long                             count;
+        unsigned long long                             total_us;
+        unsigned long long                             bytes_in;
+        unsigned long long                             bytes_out;
+    };
+    
+    series_totals sum_shards( const series& s )
+    {
+        series_totals totals{};
+        
+        for( auto& shard : s )
+        {
+            for( std::size_t i{ 0 }; i < bucket_count; ++i )
+            {
+                auto n{ relaxed_load( shard.buckets[ i ] ) };
+                totals.buckets[ i ] += n;
+                totals.count        += n;
+            }
+            totals.total_us  += relaxed_load( shard.total_us  );
+            totals.bytes_in  += relaxed_load( shard.bytes_in  );
+            totals.bytes_out += relaxed_load( shard.bytes_out );
+        }
+        
+        return totals;
+    }
+    
+    std::string seconds( unsigned long long us )
+    {
+        auto s{ std::to_string( us / 1000000 ) };
+        auto fraction{ std::to_string( us % 1000000 ) };
+        return s + "." + std::string( 6 - fraction.size(), '0' ) + fraction;
+    }
+    
+    std::string labels( const series_key& key )
+    {
+        return (
+            "method=\"" + key.method
+            + "\",route=\"" + key.route
+            + "\",status=\"" + std::to_string( key.status )
+            + "\""
+        );
+    }
+    
+    void append_family_header(
+        std::string      & out,
+        const std::string& name,
+        const std::string& type,
+        const std::string& help
+    )
+    {
+        out += "# HELP " + name + " " + help + "\n";
+        out += "# TYPE " + name + " " + type + "\n";
+    }
+    
+    void append_sample(
+        std::string       & out,
+        const std::string & name,
+        const std::string & labels,
+        const std::string & value
+    )
+    {
+        out += name;
+        if( !labels.empty() )
+            out += "{" + labels + "}";
+        out += " " + value + "\n";
+    }
+    
+    void append_sample(
+        std::string       & out,
+        const std::string & name,
+        const std::string & labels,
+        unsigned long long  value
+    )
+    {
+        append_sample( out, name, labels, std::to_string( value ) );
+    }
+}
+
+
+namespace stickers
+{
+    void record_request_metrics(
+        const routed_request& routed,
+        const access_record & record
+    )
+    {
+        auto& shard{ this_thread_series_shard( routed, record ) };
+        
+        auto us{ std::chrono::duration_cast< std::chrono::microseconds >(
+            record.total
+        ).count() };
+        
+        relaxed_add( shard.buckets[ bucket_index( us ) ], 1                );
+        relaxed_add( shard.total_us                     , us               );
+        relaxed_add( shard.bytes_in                     , record.bytes_in  );
+        relaxed_add( shard.bytes_out                    , record.bytes_out );
+    }
+    
+    void record_upload_bytes( std::size_t bytes )
+    {
+        relaxed_add( upload_bytes[ this_thread_shard() ].value, bytes );
+    }
+    
+    std::string format_metrics()
+    {
+        // Summed under the registry lock, formatted after releasing it
+        std::vector< std::pair< series_key, series_totals > > snapshot;
+        shared_registry().for_each(
+            [ &snapshot ]( const series_key& key, const series& s ){
+                snapshot.emplace_back( key, sum_shards( s ) );
+            }
+        );
+        
+        std::string out;
+        
+        append_family_header(
+            out,
+            "stickers_http_requests_total",
+            "counter",
+            "Requests handled, by method, route, and response status"
+        );
+        for( auto& [ key, totals ] : snapshot )
+            append_sample(
+                out,
+                "stickers_http_requests_total",
+                labels( key ),
+                totals.count
+            );
+        
+        append_family_header(
+            out,
+            "stickers_http_request_duration_seconds",
+            "histogram",
+            "Time from routing a request to finishing its response"
+        );
+        for( auto& [ key, totals ] : snapshot )
+        {
+            auto key_labels{ labels( key ) };
+            unsigned long long cumulative{ 0 };
+            
+            for( std::size_t i{ 0 }; i < bucket_count; ++i )
+            {
+                cumulative += totals.buckets[ i ];
+                append_sample(
+                    out,
+                    "stickers_http_request_duration_seconds_bucket",
+                    key_labels + ",le=\"" + (
+                        i + 1 < bucket_count
+                        ? seconds( bucket_bound_us( i ) )
+                        : "+Inf"
+                    ) + "\"",
+                    cumulative
+                );
+            }
+            append_sample(
+                out,
+                "stickers_http_request_duration_seconds_sum",
+                key_labels,
+                seconds( totals.total_us )
+            );
+            append_sample(
+                out,
+                "stickers_http_request_duration_seconds_count",
+                key_labels,
+                totals.count
+            );
+        }
+        
+        append_family_header(
+            out,
+            "stickers_http_request_bytes_total",
+            "counter",
+            "Request content bytes received"
+        );
+        for( auto& [ key, totals ] : snapshot )
+            append_sample(
+                out,
+                "stickers_http_request_bytes_total",
+                labels( key ),
+                totals.bytes_in
+            );
+        
+        append_family_header(
+            out,
+            "stickers_http_response_bytes_total",
+            "counter",
+            "Response content bytes sent"
+        );
+        for( auto& [ key, totals ] : snapshot )
+            append_sample(
+                out,
+                "stickers_http_response_bytes_total",
+                labels( key ),
+                totals.bytes_out
+            );
+        
+        unsigned long long uploaded{ 0 };
+        for( auto& shard : upload_bytes )
+            uploaded += relaxed_load( shard.value );
+        append_family_header(
+            out,
+            "stickers_upload_bytes_total",
+            "counter",
+            "Request bytes of successful media uploads"
+        );
+        append_sample( out, "stickers_upload_bytes_total", "", uploaded );
+        
+        auto load{ current_server_load() };
+        for( auto& [ name, help, value ] : {
+            std::make_tuple(
+                "stickers_workers",
+                "Connection worker threads",
+                load.workers
+            ),
+            std::make_tuple(
+                "stickers_busy_workers",
+                "Worker threads currently serving a connection",
+                load.busy_workers
+            ),
+            std::make_tuple(
+                "stickers_idle_workers",
+                "Busy worker threads waiting for a connection's next request",
+                load.idle_workers
+            ),
+            std::make_tuple(
+                "stickers_queued_connections",
+                "Accepted connections waiting for a worker",
+                load.queued_connections
+            ),
+            std::make_tuple(
+                "stickers_queue_capacity",
+                "Connections that can wait for a worker before being rejected",
+                load.queue_capacity
+            )
+        } )
+        {
+            append_family_header( out, name, "gauge", help );
+            append_sample( out, name, "", value );
+        }
+        
+        auto pool{ postgres::current_pool_stats() };
+        append_family_header(
+            out,
+            "stickers_db_pool_connections",
+            "gauge",
+            "Database connections by state"
+        );
+        append_sample(
+            out,
+            "stickers_db_pool_connections",
+            "state=\"idle\"",
+            pool.idle
+        );
+        append_sample(
+            out,
+            "stickers_db_pool_connections",
+            "state=\"in_use\"",
+            pool.in_use
+        );
+        append_sample(
+            out,
+            "stickers_db_pool_connections",
+            "state=\"connecting\"",
+            pool.open - pool.idle - pool.in_use
+        );
+        for( auto& [ name, help, value ] : {
+            std::make_tuple(
+                "stickers_db_pool_created_total",
+                "Database connections opened",
+                pool.created
+            ),
+            std::make_tuple(
+                "stickers_db_pool_acquisitions_total",
+                "Database connections leased from the pool",
+                pool.acquisitions
+            ),
+            std::make_tuple(
+                "stickers_db_pool_timeouts_total",
+                "Requests that gave up waiting for a database connection",
+                pool.timeouts
+            )
+        } )
+        {
+            append_family_header( out, name, "counter", help );
+            append_sample( out, name, "", value );
+        }
+        append_family_header(
+            out,
+            "stickers_db_pool_wait_seconds_total",
+            "counter",
+            "Time spent waiting for database connections"
+        );
+        append_sample(
+            out,
+            "stickers_db_pool_wait_seconds_total",
+            "",
+            seconds( pool.total_wait.count() )
+        );
+        append_family_header(
+            out,
+            "stickers_db_pool_max_wait_seconds",
+            "gauge",
+            "Longest wait for a database connection so far"
+        );
+        append_sample(
+            out,
+            "stickers_db_pool_max_wait_seconds",
+            "",
+            seconds( pool.max_wait.count() )
+        );
+        
+        return out;
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+#ifndef STICKERS_MOE_SERVER_METRICS_HPP
+#define STICKERS_MOE_SERVER_METRICS_HPP
+
+
+#include "access_log.hpp"
+#include "route_table.hpp"
+
+#include <cstddef>  // std::size_t
+#include <optional>
+#include <string>
+
+
+namespace stickers
+{
+    // Where a request was routed; together with the status this identifies
+    // its series without building or comparing any strings
+    struct routed_request
+    {
+        const route_table::node*     node;      // Deepest matched, if any
+        bool                         found;     // `node` matched the whole path
+        std::optional< http_method > method;
+    };
+    
+    // Count a finished request and its latency under its method, route
+    // template, and status; counters are split into per-thread shards so
+    // recording never waits on other workers or on a scrape in progress, and
+    // only a thread's first request in a series allocates anything
+    void record_request_metrics( const routed_request&, const access_record& );
+    void record_upload_bytes( std::size_t );
+    
+    // Everything recorded so far plus the current server and database pool
+    // load, in Prometheus' text exposition format
+    std::string format_metrics();
+}
+
+
+#endif
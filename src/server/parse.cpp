@@ -5,15 +5,18 @@
 
 #include "handler.hpp"
 #include "../common/config.hpp"
-#include "../common/json.hpp"
 #include "../common/logging.hpp"
-#include "../common/string_utils.hpp"
+#include "../common/request_arena.hpp"
+#include "../common/request_timing.hpp"
 
 #include <show/constants.hpp>
 #include <show/multipart.hpp>
 
-#include <cmath>
+#include <cerrno>
+#include <cmath>    // std::modf()
+#include <cstdlib>  // std::strtol(), std::strtod()
 #include <iterator> // std::istreambuf_iterator
+#include <limits>
 #include <optional>
 #include <vector>
 
@@ -297,42 +300,413 @@ namespace // Utilities /////////////////////////////////////////////////////////
         return info;
     }
     
-    stickers::document json_to_document( nlj::json& parsed )
+    void assert_content_length( const show::request& request )
     {
-        if( parsed.is_null() )
-            return nullptr;
-        else if( parsed.is_boolean() )
-            return parsed.get< bool >();
-        else if( parsed.is_number() )
+        auto max_length{
+            stickers::current_settings().server.max_request_bytes
+        };
+        
+        if( request.unknown_content_length() )
+            throw stickers::handler_exit{
+                show::code::BAD_REQUEST,
+                "Missing \"Content-Length\" header"
+            };
+        else if( request.content_length() > max_length )
+            throw stickers::handler_exit{
+                show::code::PAYLOAD_TOO_LARGE,
+                (
+                    "Maximum request content size is "
+                    + std::to_string( max_length )
+                    + " bytes"
+                )
+            };
+    }
+}
+
+
+namespace // JSON parser ///////////////////////////////////////////////////////
+{
+    // Recursive descent parser that reads straight from the request's buffer
+    // and builds the document as it goes, rather than parsing into an
+    // `nlj::json` and copying that; integral numbers become `int_document`s,
+    // other numbers `float_document`s
+    class json_parser
+    {
+    public:
+        json_parser( std::streambuf& buffer ) :
+            buffer{ buffer                            },
+            arena { stickers::current_request_arena() }
+        {}
+        
+        stickers::document parse()
         {
-            double  integer_part;
-            double fraction_part{ std::modf(
-                parsed.get< double >(),
-                &integer_part
-            ) };
+            auto doc{ parse_value() };
             
-            if( fraction_part > 0 )
-                return parsed.get< double >();
-            else
-                return parsed.get< long >();
+            skip_whitespace();
+            if( peek() != eof )
+                malformed();
+            
+            return doc;
+        }
+    
+    protected:
+        static constexpr auto eof{ std::char_traits< char >::eof() };
+        
+        // Deep enough for any real payload without risking the stack
+        static constexpr unsigned int max_depth{ 256 };
+        
+        std::streambuf         & buffer;
+        stickers::request_arena& arena;
+        unsigned int             depth{ 0 };
+        std::string              number;    // Reused between numbers
+        
+        [[noreturn]] static void malformed()
+        {
+            throw stickers::handler_exit{
+                show::code::BAD_REQUEST,
+                "Malformed JSON payload"
+            };
+        }
+        
+        int peek() { return buffer.sgetc(); }
+        int next() { return buffer.sbumpc(); }
+        
+        void expect( char c )
+        {
+            if( next() != std::char_traits< char >::to_int_type( c ) )
+                malformed();
+        }
+        
+        void expect_literal( const char* literal )
+        {
+            for( ; *literal; ++literal )
+                expect( *literal );
+        }
+        
+        void skip_whitespace()
+        {
+            for( ; ; )
+                switch( peek() )
+                {
+                case ' ':
+                case '\t':
+                case '\n':
+                case '\r':
+                    next();
+                    break;
+                default:
+                    return;
+                }
         }
-        else if( parsed.is_object() )
+        
+        stickers::document parse_value()
+        {
+            skip_whitespace();
+            
+            switch( peek() )
+            {
+            case '{':
+                return parse_object();
+            case '[':
+                return parse_array();
+            case '"':
+                return parse_string();
+            case 't':
+                expect_literal( "true" );
+                return true;
+            case 'f':
+                expect_literal( "false" );
+                return false;
+            case 'n':
+                expect_literal( "null" );
+                return stickers::null_document{};
+            default:
+                return parse_number();
+            }
+        }
+        
+        stickers::document parse_object()
         {
-            stickers::document doc{ stickers::map_document{} };
-            for( auto pair = parsed.begin(); pair != parsed.end(); ++pair )
-                doc.get< stickers::map_document >()[ pair.key() ] = json_to_document( pair.value() );
+            if( ++depth > max_depth )
+                malformed();
+            
+            next();     // '{'
+            stickers::document doc{ stickers::map_document{ arena } };
+            auto& map{ doc.get< stickers::map_document >() };
+            
+            skip_whitespace();
+            if( peek() == '}' )
+                next();
+            else
+                for( ; ; )
+                {
+                    skip_whitespace();
+                    if( peek() != '"' )
+                        malformed();
+                    auto key{ parse_string() };
+                    
+                    skip_whitespace();
+                    expect( ':' );
+                    
+                    // Later duplicates replace earlier ones
+                    map.insert_or_assign( std::move( key ), parse_value() );
+                    
+                    skip_whitespace();
+                    auto c{ next() };
+                    if( c == '}' )
+                        break;
+                    else if( c != ',' )
+                        malformed();
+                }
+            
+            --depth;
             return doc;
         }
-        else if( parsed.is_array() )
+        
+        stickers::document parse_array()
         {
-            stickers::document doc{ stickers::map_document{} };
-            for( stickers::int_document i = 0; i < parsed.size(); ++i )
-                doc.get< stickers::map_document >()[ i ] = json_to_document( parsed[ i ] );
+            if( ++depth > max_depth )
+                malformed();
+            
+            next();     // '['
+            stickers::document doc{ stickers::array_document{ arena } };
+            auto& array{ doc.get< stickers::array_document >() };
+            
+            skip_whitespace();
+            if( peek() == ']' )
+                next();
+            else
+                for( ; ; )
+                {
+                    array.emplace_back( parse_value() );
+                    
+                    skip_whitespace();
+                    auto c{ next() };
+                    if( c == ']' )
+                        break;
+                    else if( c != ',' )
+                        malformed();
+                }
+            
+            --depth;
             return doc;
         }
-        else /*if( parsed.is_string() )*/
-            return std::move( parsed.get< std::string >() );
-    }
+        
+        unsigned int parse_hex4()
+        {
+            unsigned int value{ 0 };
+            for( int i = 0; i < 4; ++i )
+            {
+                auto c{ next() };
+                value <<= 4;
+                if( c >= '0' && c <= '9' )
+                    value |= c - '0';
+                else if( c >= 'a' && c <= 'f' )
+                    value |= c - 'a' + 10;
+                else if( c >= 'A' && c <= 'F' )
+                    value |= c - 'A' + 10;
+                else
+                    malformed();
+            }
+            return value;
+        }
+        
+        static void append_utf8( std::string& s, unsigned int code_point )
+        {
+            auto continuation{ [ &s, code_point ]( unsigned int shift ){
+                s += static_cast< char >(
+                    0x80 | ( ( code_point >> shift ) & 0x3F )
+                );
+            } };
+            
+            if( code_point < 0x80 )
+                s += static_cast< char >( code_point );
+            else if( code_point < 0x800 )
+            {
+                s += static_cast< char >( 0xC0 | ( code_point >> 6 ) );
+                continuation( 0 );
+            }
+            else if( code_point < 0x10000 )
+            {
+                s += static_cast< char >( 0xE0 | ( code_point >> 12 ) );
+                continuation( 6 );
+                continuation( 0 );
+            }
+            else
+            {
+                s += static_cast< char >( 0xF0 | ( code_point >> 18 ) );
+                continuation( 12 );
+                continuation(  6 );
+                continuation(  0 );
+            }
+        }
+        
+        // Copies one UTF-8 sequence starting with `lead` into `s`, rejecting
+        // invalid, overlong, and surrogate encodings
+        void append_utf8_sequence( std::string& s, int lead )
+        {
+            unsigned int length, minimum, code_point;
+            if( lead >= 0xC2 && lead <= 0xDF )
+            {
+                length = 2;
+                minimum = 0x80;
+                code_point = lead & 0x1F;
+            }
+            else if( lead >= 0xE0 && lead <= 0xEF )
+            {
+                length = 3;
+                minimum = 0x800;
+                code_point = lead & 0x0F;
+            }
+            else if( lead >= 0xF0 && lead <= 0xF4 )
+            {
+                length = 4;
+                minimum = 0x10000;
+                code_point = lead & 0x07;
+            }
+            else
+                malformed();
+            
+            s += static_cast< char >( lead );
+            for( unsigned int i = 1; i < length; ++i )
+            {
+                auto c{ next() };
+                if( c == eof || ( c & 0xC0 ) != 0x80 )
+                    malformed();
+                code_point = ( code_point << 6 ) | ( c & 0x3F );
+                s += static_cast< char >( c );
+            }
+            
+            if(
+                code_point < minimum
+                || code_point > 0x10FFFF
+                || ( code_point >= 0xD800 && code_point <= 0xDFFF )
+            )
+                malformed();
+        }
+        
+        std::string parse_string()
+        {
+            next();     // '"'
+            std::string s;
+            
+            for( ; ; )
+            {
+                auto c{ next() };
+                
+                if( c == '"' )
+                    return s;
+                else if( c == eof || c < 0x20 )
+                    malformed();
+                else if( c >= 0x80 )
+                    append_utf8_sequence( s, c );
+                else if( c != '\\' )
+                    s += static_cast< char >( c );
+                else
+                    switch( next() )
+                    {
+                    case '"' : s += '"' ; break;
+                    case '\\': s += '\\'; break;
+                    case '/' : s += '/' ; break;
+                    case 'b' : s += '\b'; break;
+                    case 'f' : s += '\f'; break;
+                    case 'n' : s += '\n'; break;
+                    case 'r' : s += '\r'; break;
+                    case 't' : s += '\t'; break;
+                    case 'u' :
+                        {
+                            auto code_point{ parse_hex4() };
+                            
+                            // UTF-16 surrogate pairs are escaped separately
+                            if( code_point >= 0xD800 && code_point <= 0xDBFF )
+                            {
+                                expect( '\\' );
+                                expect( 'u' );
+                                auto low{ parse_hex4() };
+                                if( low < 0xDC00 || low > 0xDFFF )
+                                    malformed();
+                                code_point = 0x10000 + (
+                                    ( code_point - 0xD800 ) << 10
+                                ) + ( low - 0xDC00 );
+                            }
+                            else if(
+                                code_point >= 0xDC00
+                                && code_point <= 0xDFFF
+                            )
+                                malformed();
+                            
+                            append_utf8( s, code_point );
+                        }
+                        break;
+                    default:
+                        malformed();
+                    }
+            }
+        }
+        
+        bool append_digits()
+        {
+            bool any{ false };
+            while( peek() >= '0' && peek() <= '9' )
+            {
+                number += static_cast< char >( next() );
+                any = true;
+            }
+            return any;
+        }
+        
+        stickers::document parse_number()
+        {
+            number.clear();
+            bool integral{ true };
+            
+            if( peek() == '-' )
+                number += static_cast< char >( next() );
+            
+            if( peek() == '0' )
+                number += static_cast< char >( next() );
+            else if( !append_digits() )
+                malformed();
+            
+            if( peek() == '.' )
+            {
+                integral = false;
+                number += static_cast< char >( next() );
+                if( !append_digits() )
+                    malformed();
+            }
+            
+            if( peek() == 'e' || peek() == 'E' )
+            {
+                integral = false;
+                number += static_cast< char >( next() );
+                if( peek() == '+' || peek() == '-' )
+                    number += static_cast< char >( next() );
+                if( !append_digits() )
+                    malformed();
+            }
+            
+            if( integral )
+            {
+                errno = 0;
+                auto value{ std::strtol( number.c_str(), nullptr, 10 ) };
+                if( errno != ERANGE )
+                    return value;
+            }
+            
+            // Written as a float but with no fractional part, e.g. "1.0" or
+            // "1e3", still counts as integral if it fits
+            auto value{ std::strtod( number.c_str(), nullptr ) };
+            double integer_part;
+            if(
+                std::modf( value, &integer_part ) == 0
+                && value >= std::numeric_limits< long >::min()
+                && value <  std::numeric_limits< long >::max()
+            )
+                return static_cast< long >( value );
+            return value;
+        }
+    };
 }
 
 
@@ -431,33 +805,37 @@ namespace // Parser implementations ////////////////////////////////////////////
         const show::headers_type& request_headers
     )
     {
-        nlj::json parsed;
-        bool malformed_json{ false };
-        
-        try
-        {
-            std::istream request_stream{ &buffer };
-            request_stream >> parsed;
-            malformed_json = !request_stream.good();
-        }
-        catch( const nlj::json::parse_error& e )
-        {
-            malformed_json = true;
-        }
-        
-        if( malformed_json )
-            throw stickers::handler_exit{
-                show::code::BAD_REQUEST,
-                "Malformed JSON payload"
-            };
-        else
+        auto doc{ stickers::parse_json_content( buffer ) };
+        doc.mime_type = "application/json";
+        return doc;
+    }
+    
+    // The byte for a `%XX` escape, reading the two digits after the '%'
+    char decode_form_escape( std::streambuf& buffer )
+    {
+        int value{ 0 };
+        for( int i = 0; i < 2; ++i )
         {
-            auto doc{ json_to_document( parsed ) };
-            doc.mime_type = "application/json";
-            return doc;
+            auto c{ buffer.sbumpc() };
+            value <<= 4;
+            if( c >= '0' && c <= '9' )
+                value |= c - '0';
+            else if( c >= 'a' && c <= 'f' )
+                value |= c - 'a' + 10;
+            else if( c >= 'A' && c <= 'F' )
+                value |= c - 'A' + 10;
+            else
+                throw stickers::handler_exit{
+                    show::code::BAD_REQUEST,
+                    "malformed form content"
+                };
         }
+        return static_cast< char >( value );
     }
     
+    // Decodes each name & value in a single pass straight into a reused
+    // buffer; in `a=b=c` every name gets the last value, and a name with no
+    // value at all is `true`
     stickers::document parse_form_urlencoded(
         std::streambuf          & buffer,
         const show::headers_type& headers,
@@ -465,30 +843,55 @@ namespace // Parser implementations ////////////////////////////////////////////
         const show::headers_type& request_headers
     )
     {
-        stickers::document doc{ stickers::map_document{} };
+        stickers::document doc{
+            stickers::map_document{ stickers::current_request_arena() }
+        };
         doc.mime_type = "application/x-www-form-urlencoded";
+        auto& map{ doc.get< stickers::map_document >() };
         
-        for( const auto& exp_set : stickers::split<
-            std::vector< std::string >
-        >( std::string{
-            std::istreambuf_iterator< char >{ &buffer },
-            {}
-        }, std::string{ "&" } ) )
+        std::vector< std::string > names;   // Waiting for their value
+        std::string                token;
+        
+        auto end_pair{ [ & ]{
+            if( !names.empty() )
+            {
+                // Later duplicates replace earlier ones
+                for( auto& name : names )
+                    map.insert_or_assign( std::move( name ), token );
+                names.clear();
+            }
+            else if( !token.empty() )
+                map.insert_or_assign( std::move( token ), true );
+            token.clear();
+        } };
+        
+        for( ; ; )
         {
-            auto exp{ stickers::split< std::vector< std::string > >(
-                exp_set,
-                std::string{ "=" }
-            ) };
+            auto c{ buffer.sbumpc() };
+            if( c == std::char_traits< char >::eof() )
+                break;
             
-            if( exp.size() == 1 )
-                doc.get< stickers::map_document >()[ show::url_decode( exp[ 0 ] ) ] = true;
-            else
+            switch( c )
             {
-                auto value{ show::url_decode( exp.back() ) };
-                for( auto i = 0; i < exp.size() - 1; ++i )
-                    doc.get< stickers::map_document >()[ show::url_decode( exp[ i ] ) ] = value;
+            case '&':
+                end_pair();
+                break;
+            case '=':
+                names.push_back( std::move( token ) );
+                token.clear();
+                break;
+            case '+':
+                token += ' ';
+                break;
+            case '%':
+                token += decode_form_escape( buffer );
+                break;
+            default:
+                token += static_cast< char >( c );
+                break;
             }
         }
+        end_pair();
         
         return doc;
     }
@@ -516,7 +919,9 @@ namespace // Parser implementations ////////////////////////////////////////////
             )
         };
         
-        stickers::document doc{ stickers::map_document{} };
+        stickers::document doc{
+            stickers::map_document{ stickers::current_request_arena() }
+        };
         
         for( auto& segment : parser )
         {
@@ -555,27 +960,73 @@ namespace // Parser implementations ////////////////////////////////////////////
 
 namespace stickers // Request parse ////////////////////////////////////////////
 {
-    document parse_request_content( show::request& request )
+    document parse_json_content( std::streambuf& buffer )
     {
-        auto max_length{
-            config()[ "server" ][ "max_request_bytes" ].get< std::streamsize >()
-        };
+        return json_parser{ buffer }.parse();
+    }
+    
+    void for_each_multipart_segment(
+        show::request                   & request,
+        const multipart_segment_handler & handler
+    )
+    {
+        phase_timer timer{ request_phase::PARSE };
         
-        if( request.unknown_content_length() )
+        assert_content_length( request );
+        
+        auto content_type{ content_type_from_headers( request.headers() ) };
+        if(
+            !content_type
+            || content_type -> mime_type.substr(
+                0,
+                content_type -> mime_type.find( "/" )
+            ) != "multipart"
+        )
             throw handler_exit{
                 show::code::BAD_REQUEST,
-                "Missing \"Content-Length\" header"
-            };
-        else if( request.content_length() > max_length )
-            throw handler_exit{
-                show::code::PAYLOAD_TOO_LARGE,
-                (
-                    "Maximum request content size is "
-                    + std::to_string( max_length )
-                    + " bytes"
-                )
+                "expected multipart content"
             };
         
+        show::multipart parser{
+            request,
+            boundary_from_content_type_remainder(
+                content_type -> mime_type,
+                content_type -> header_remainder
+            )
+        };
+        
+        for( auto& segment : parser )
+        {
+            multipart_segment_info info;
+            
+            auto names{ split_multipart_info(
+                segment.headers(),
+                request.headers()
+            ) };
+            if( names )
+            {
+                info.name     = names -> name;
+                info.filename = names -> filename;
+            }
+            
+            auto segment_type{ content_type_from_headers( segment.headers() ) };
+            if( segment_type )
+                info.mime_type = segment_type -> mime_type;
+            
+            handler( segment, info );
+            
+            // Whatever the handler left unread
+            char discard[ 1024 ];
+            while( segment.sgetn( discard, sizeof( discard ) ) > 0 );
+        }
+    }
+    
+    document parse_request_content( show::request& request )
+    {
+        phase_timer timer{ request_phase::PARSE };
+        
+        assert_content_length( request );
+        
         return parse_request_content_recursive(
             request,
             request.headers(),
@@ -5,10 +5,40 @@
 
 #include "../common/document.hpp"
 
+#include <functional>   // std::function
+#include <optional>
+#include <streambuf>
+#include <string>
+
 
 namespace stickers
 {
     document parse_request_content( show::request& );
+    
+    // Parse a complete JSON body straight into a document; throws a
+    // `handler_exit` if it's malformed
+    document parse_json_content( std::streambuf& );
+    
+    struct multipart_segment_info
+    {
+        std::optional< std::string > name;
+        std::optional< std::string > filename;
+        std::optional< std::string > mime_type;
+    };
+    
+    using multipart_segment_handler = std::function< void(
+        std::streambuf&,
+        const multipart_segment_info&
+    ) >;
+    
+    // Hand each segment of a `multipart/*` request body to `handler` as it's
+    // read rather than buffering the whole body, so large uploads can be
+    // streamed elsewhere; segments the handler doesn't read are skipped.
+    // Throws `handler_exit` if the body isn't multipart.
+    void for_each_multipart_segment(
+        show::request&,
+        const multipart_segment_handler&
+    );
 }
 
 
@@ -0,0 +1,230 @@
+#line 2 "server/route_table.cpp"
+
+
+#include "route_table.hpp"
+
+#include <cctype>       // std::toupper()
+#include <stdexcept>
+
+
+namespace
+{
+    const std::array<
+        const char*,
+        stickers::http_method_count
+    > method_names{
+        "GET",
+        "HEAD",
+        "POST",
+        "PUT",
+        "DELETE",
+        "OPTIONS",
+        "PATCH"
+    };
+    
+    // FNV-1a with the seed mixed into the offset basis, and the high bits
+    // folded into the low ones that are used as the slot index
+    std::uint32_t segment_hash( const std::string& segment, std::uint32_t seed )
+    {
+        std::uint32_t hash{ 2166136261u ^ ( seed * 0x9e3779b9u ) };
+        for( unsigned char c : segment )
+        {
+            hash ^= c;
+            hash *= 16777619u;
+        }
+        return hash ^ ( hash >> 16 );
+    }
+}
+
+
+namespace stickers
+{
+    std::optional< http_method > parse_http_method( const std::string& method )
+    {
+        for( std::size_t i{ 0 }; i < http_method_count; ++i )
+        {
+            const char* name{ method_names[ i ] };
+            std::size_t j{ 0 };
+            
+            while(
+                j < method.size()
+                && name[ j ]
+                && std::toupper(
+                    static_cast< unsigned char >( method[ j ] )
+                ) == name[ j ]
+            )
+                ++j;
+            
+            if( j == method.size() && !name[ j ] )
+                return static_cast< http_method >( i );
+        }
+        
+        return std::nullopt;
+    }
+    
+    const char* http_method_name( http_method method )
+    {
+        return method_names[ static_cast< std::size_t >( method ) ];
+    }
+    
+    route_table::route_table( const route_spec& spec )
+    {
+        add_node( spec, "", 0 );
+    }
+    
+    route_table::match route_table::find(
+        const std::vector< std::string >& path,
+        handler_vars_type               & variables
+    ) const
+    {
+        const node* current{ &all_nodes[ 0 ] };
+        
+        for( auto& element : path )
+        {
+            auto next{ no_node };
+            
+            if( !current -> sub_names.empty() )
+            {
+                auto& found{ slots[
+                    current -> first_slot
+                    + (
+                        segment_hash( element, current -> hash_seed )
+                        & current -> slot_mask
+                    )
+                ] };
+                if( found.node != no_node && found.segment == element )
+                    next = found.node;
+            }
+            
+            if( next == no_node && current -> variable_node != no_node )
+            {
+                variables.add( current -> variable_name, element );
+                next = current -> variable_node;
+            }
+            
+            if( next == no_node )
+                return { nullptr, current };
+            
+            current = &all_nodes[ next ];
+        }
+        
+        return { current, current };
+    }
+    
+    const std::vector< route_table::node >& route_table::nodes() const
+    {
+        return all_nodes;
+    }
+    
+    std::size_t route_table::add_node(
+        const route_spec & spec,
+        const std::string& route,
+        std::size_t        variable_count
+    )
+    {
+        if( variable_count > handler_vars_type::capacity )
+            throw std::logic_error{
+                "route "
+                + route
+                + " has more variables than handler_vars_type can hold"
+            };
+        
+        // Children are added recursively, so refer to this node by index
+        // rather than holding a reference into `all_nodes`
+        auto index{ all_nodes.size() };
+        all_nodes.push_back( {
+            {},
+            route.empty() ? "/" : route,
+            {},
+            "",
+            no_node,
+            0,
+            0,
+            0
+        } );
+        
+        for( auto& [ method, handler ] : spec.methods )
+        {
+            auto parsed{ parse_http_method( method ) };
+            if( !parsed )
+                throw std::logic_error{
+                    "route "
+                    + all_nodes[ index ].route
+                    + " has unsupported method "
+                    + method
+                };
+            all_nodes[ index ].handlers[
+                static_cast< std::size_t >( *parsed )
+            ] = handler;
+        }
+        
+        std::vector< std::pair< std::string, std::size_t > > subs;
+        for( auto& [ segment, sub_spec ] : spec.subs )
+        {
+            subs.emplace_back(
+                segment,
+                add_node( sub_spec, route + "/" + segment, variable_count )
+            );
+            all_nodes[ index ].sub_names.push_back( segment );
+        }
+        hash_subs( index, subs );
+        
+        if( spec.variable )
+        {
+            auto variable_node{ add_node(
+                spec.variable -> second,
+                route + "/{" + spec.variable -> first + "}",
+                variable_count + 1
+            ) };
+            all_nodes[ index ].variable_name = spec.variable -> first;
+            all_nodes[ index ].variable_node = variable_node;
+        }
+        
+        return index;
+    }
+    
+    // Tries seeds until every sub lands in its own slot, growing the table if
+    // none work; with the handful of subs any one node has this takes a few
+    // tries at most
+    void route_table::hash_subs(
+        std::size_t node,
+        const std::vector< std::pair< std::string, std::size_t > >& subs
+    )
+    {
+        if( subs.empty() )
+            return;
+        
+        std::size_t size{ 1 };
+        while( size < subs.size() )
+            size *= 2;
+        
+        for( ; ; size *= 2 )
+            for( std::uint32_t seed{ 0 }; seed < 1024; ++seed )
+            {
+                std::vector< slot > table( size, slot{ "", no_node } );
+                bool collided{ false };
+                
+                for( auto& [ segment, sub_node ] : subs )
+                {
+                    auto& s{ table[
+                        segment_hash( segment, seed ) & ( size - 1 )
+                    ] };
+                    if( s.node != no_node )
+                    {
+                        collided = true;
+                        break;
+                    }
+                    s = { segment, sub_node };
+                }
+                
+                if( collided )
+                    continue;
+                
+                all_nodes[ node ].hash_seed  = seed;
+                all_nodes[ node ].first_slot = slots.size();
+                all_nodes[ node ].slot_mask  = size - 1;
+                slots.insert( slots.end(), table.begin(), table.end() );
+                return;
+            }
+    }
+}
@@ -0,0 +1,123 @@
+#pragma once
+#ifndef STICKERS_MOE_SERVER_ROUTE_TABLE_HPP
+#define STICKERS_MOE_SERVER_ROUTE_TABLE_HPP
+
+
+#include "handler.hpp"
+
+#include <show.hpp>
+
+#include <array>
+#include <cstddef>  // std::size_t
+#include <cstdint>  // std::uint32_t
+#include <limits>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>  // std::pair<>
+#include <vector>
+
+
+namespace stickers
+{
+    enum class http_method : std::size_t
+    {
+        GET,
+        HEAD,
+        POST,
+        PUT,
+        DELETE,
+        OPTIONS,
+        PATCH
+    };
+    
+    constexpr std::size_t http_method_count{ 7 };
+    
+    // Case-insensitive; `std::nullopt` for any method not listed above
+    std::optional< http_method > parse_http_method( const std::string& );
+    const char* http_method_name( http_method );
+    
+    // Readable form of a route tree, compiled into a `route_table` once at
+    // startup; a request path element matches a static sub before a variable
+    struct route_spec
+    {
+        using methods_type = std::map<
+            std::string,
+            handler_type,
+            show::_less_ignore_case_ASCII
+        >;
+        using subs_type = std::map<
+            std::string,
+            route_spec
+        >;
+        using variable_type = std::pair< std::string, route_spec >;
+        
+        methods_type   methods;
+        subs_type      subs;
+        variable_type* variable;
+    };
+    
+    // A `route_spec` flattened into one array of nodes, with each node's
+    // static subs in a perfect hash table and its handlers indexed by method
+    class route_table
+    {
+    public:
+        static constexpr std::size_t no_node{
+            std::numeric_limits< std::size_t >::max()
+        };
+        
+        struct node
+        {
+            std::array< handler_type, http_method_count > handlers;
+            std::string                                   route;
+            std::vector< std::string >                    sub_names;
+            std::string                                   variable_name;
+            std::size_t                                   variable_node;
+            std::uint32_t                                 hash_seed;
+            std::size_t                                   first_slot;
+            std::size_t                                   slot_mask;
+        };
+        
+        struct match
+        {
+            const node* found;      // `nullptr` if the path doesn't exist
+            const node* deepest;    // Last node matched along the path
+        };
+        
+        // Throws `std::logic_error` if the spec names an unknown method or has
+        // a route with more variables than `handler_vars_type` can hold
+        explicit route_table( const route_spec& );
+        
+        // Adds the values of any variable elements to `variables`
+        match find(
+            const std::vector< std::string >& path,
+            handler_vars_type               & variables
+        ) const;
+        
+        // Every node in depth-first order, starting with the root
+        const std::vector< node >& nodes() const;
+    
+    protected:
+        struct slot
+        {
+            std::string segment;
+            std::size_t node;
+        };
+        
+        std::vector< node > all_nodes;
+        std::vector< slot > slots;
+        
+        std::size_t add_node(
+            const route_spec & spec,
+            const std::string& route,
+            std::size_t        variable_count
+        );
+        void hash_subs(
+            std::size_t node,
+            const std::vector< std::pair< std::string, std::size_t > >& subs
+        );
+    };
+}
+
+
+#endif
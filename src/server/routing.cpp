@@ -3,79 +3,64 @@
 
 #include "routing.hpp"
 
+#include "access_log.hpp"
+#include "metrics.hpp"
+#include "route_table.hpp"
 #include "server.hpp"
 #include "../common/auth.hpp"
 #include "../common/config.hpp"
 #include "../common/logging.hpp"
 #include "../common/json.hpp"
+#include "../common/password_hashing.hpp"
+#include "../common/postgres.hpp"
+#include "../common/request_timing.hpp"
 #include "../common/string_utils.hpp"
 #include "../handlers/handlers.hpp"
 
 #include <show/constants.hpp>
 
+#include <chrono>
 #include <exception>
-#include <map>
 #include <vector>
 
 
 namespace
 {
-    struct routing_node
-    {
-        using methods_type = std::map<
-            std::string,
-            stickers::handler_type,
-            show::_less_ignore_case_ASCII
-        >;
-        using subs_type = std::map<
-            std::string,
-            routing_node
-        >;
-        using variable_type = std::pair< std::string, routing_node >;
-        
-        methods_type   methods;
-        subs_type      subs;
-        variable_type* variable;
-    };
-    
     void handle_options_request(
         show::request& request,
-        const routing_node* current_node
+        const stickers::route_table::node* current_node
     )
     {
-        std::vector< std::string > methods_list, subs_list;
+        std::vector< std::string > methods_list;
         
-        for( auto& method : current_node -> methods )
-            methods_list.push_back( method.first );
-        for( auto& sub : current_node -> subs )
-            subs_list.push_back( sub.first );
+        for( std::size_t i{ 0 }; i < stickers::http_method_count; ++i )
+            if( current_node -> handlers[ i ] )
+                methods_list.push_back( stickers::http_method_name(
+                    static_cast< stickers::http_method >( i )
+                ) );
         
         nlj::json options_object = {
-            { "methods"     , methods_list },
-            { "subs"        ,    subs_list },
-            { "variable_sub", static_cast< bool >( current_node -> variable ) }
-        };
-        std::string json_string = options_object.dump();
-        
-        show::response response{
-            request.connection(),
-            show::HTTP_1_1,
-            show::code::OK,
+            { "methods"     , methods_list              },
+            { "subs"        , current_node -> sub_names },
             {
-                show::server_header,
-                { "Content-Type"  , { "application/json" } },
-                { "Content-Length", { std::to_string( json_string.size() ) } }
+                "variable_sub",
+                current_node -> variable_node
+                != stickers::route_table::no_node
             }
         };
         
-        response.sputn( json_string.c_str(), json_string.size() );
+        stickers::send_json_response(
+            request,
+            show::code::OK,
+            options_object
+        );
     }
 }
 
 
 namespace
 {
-    routing_node::variable_type user_manip{
+    stickers::route_spec::variable_type user_manip{
         "user_id",
         {
             {
@@ -88,7 +73,7 @@ namespace
         }
     };
     
-    routing_node::variable_type list_entry_manip{
+    stickers::route_spec::variable_type list_entry_manip{
         "list_entry_id",
         {
             {
@@ -99,7 +84,7 @@ namespace
             nullptr
         }
     };
-    routing_node::variable_type list_subs{
+    stickers::route_spec::variable_type list_subs{
         "user_id",
         {
             {
@@ -111,7 +96,7 @@ namespace
         }
     };
     
-    routing_node::variable_type person_manip{
+    stickers::route_spec::variable_type person_manip{
         "person_id",
         {
             {
@@ -123,7 +108,7 @@ namespace
             nullptr
         }
     };
-    routing_node::variable_type shop_manip{
+    stickers::route_spec::variable_type shop_manip{
         "shop_id",
         {
             {
@@ -135,7 +120,7 @@ namespace
             nullptr
         }
     };
-    routing_node::variable_type design_manip{
+    stickers::route_spec::variable_type design_manip{
         "design_id",
         {
             {
@@ -147,7 +132,7 @@ namespace
             nullptr
         }
     };
-    routing_node::variable_type product_manip{
+    stickers::route_spec::variable_type product_manip{
         "product_id",
         {
             {
@@ -160,7 +145,7 @@ namespace
         }
     };
     
-    routing_node::variable_type media_info{
+    stickers::route_spec::variable_type media_info{
         "hash",
         {
             { { "GET", stickers::handlers::get_media_info } },
@@ -169,7 +154,7 @@ namespace
         }
     };
     
-    const routing_node tree{
+    const stickers::route_spec tree{
         {},
         {
             { "signup", {
@@ -212,6 +197,11 @@ namespace
                 {},
                 &product_manip
             } },
+            { "metrics", {
+                { { "GET", stickers::handlers::get_metrics } },
+                {},
+                nullptr
+            } },
             { "media", {
                 {},
                 {
@@ -231,13 +221,59 @@ namespace
         },
         nullptr
     };
+    
+    const stickers::route_table routes{ tree };
 }
 
 
 namespace stickers
 {
+    const route_table& request_routes()
+    {
+        return routes;
+    }
+    
+    void send_json_response(
+        show::request      & request,
+        show::response_code  code,
+        const nlj::json    & body,
+        show::headers_type   headers
+    )
+    {
+        phase_timer timer{ request_phase::SERIALIZATION };
+        
+        auto body_string{ body.dump() };
+        
+        headers[ "Content-Type"   ] = { "application/json" };
+        headers[ "Content-Length" ] = { std::to_string( body_string.size() ) };
+        
+        show::response response{
+            request.connection(),
+            show::HTTP_1_1,
+            code,
+            headers
+        };
+        
+        response.sputn( body_string.c_str(), body_string.size() );
+        
+        note_response( code, body_string.size() );
+    }
+    
     void route_request( show::request& request )
     {
+        auto started{ std::chrono::steady_clock::now() };
+        reset_request_timings();
+        clear_noted_response();
+        
+        // Path with variable elements replaced by their names, so requests for
+        // the same resource type share an access log route
+        std::string route_template{ "/*" };
+        routed_request routed{
+            nullptr,
+            false,
+            parse_http_method( request.method() )
+        };
+        
         bool handler_finished{ false };
         // Make copies of these constants:
         show::response_code error_code   { show::code::BAD_REQUEST };
@@ -246,41 +282,45 @@ namespace stickers
         
         try
         {
+            // Nested transaction scopes in the handler share one transaction,
+            // whose connection goes back to the pool as soon as it ends
+            postgres::request_context database;
+            
             handler_vars_type variables;
             
-            // Need a mutable pointer to const data, so `const auto*`
-            const auto* current_node{ &tree };
+            auto match{ routes.find( request.path(), variables ) };
             
-            for( auto& element : request.path() )
+            routed.node  = match.found ? match.found : match.deepest;
+            routed.found = match.found != nullptr;
+            
+            if( !match.found )
             {
-                auto found_sub{ current_node -> subs.find( element ) };
-                
-                if( found_sub != current_node -> subs.end() )
-                {
-                    current_node = &( found_sub -> second );
-                }
-                else if( current_node -> variable )
-                {
-                    variables[ current_node -> variable -> first ] = element;
-                    current_node = &( current_node -> variable -> second );
-                }
-                else
-                    throw handler_exit{ show::code::NOT_FOUND, "" };
+                route_template = (
+                    match.deepest -> route == "/"
+                    ? ""
+                    : match.deepest -> route
+                ) + "/*";
+                throw handler_exit{ show::code::NOT_FOUND, "" };
             }
             
-            auto found_method = current_node -> methods.find(
-                request.method()
-            );
+            route_template = match.found -> route;
+            
+            auto& method{ routed.method };
+            handler_type handler{ nullptr };
+            if( method )
+                handler = match.found -> handlers[
+                    static_cast< std::size_t >( *method )
+                ];
             
-            if( found_method != current_node -> methods.end() )
+            if( handler )
             {
-                found_method -> second( request, variables );
+                handler( request, variables );
             }
-            else if( request.method() == "OPTIONS" )
+            else if( method == http_method::OPTIONS )
             {
-                handle_options_request( request, current_node );
+                handle_options_request( request, match.found );
             }
-            else if( request.method() == "HEAD" )
+            else if( method == http_method::HEAD )
             {
                 // TODO: HEAD method implementation for CORS
                 throw handler_exit{
@@ -316,7 +356,7 @@ namespace stickers
                 " request from ",
                 request.client_address(),
                 " on ",
-                join( request.path(), std::string{ "/" } ),
+                join( request.path(), "/" ),
                 ": ",
                 ae.what()
             );
@@ -336,11 +376,45 @@ namespace stickers
                 " request from ",
                 request.client_address(),
                 " on ",
-                join( request.path(), std::string{ "/" } ),
+                join( request.path(), "/" ),
                 ": ",
                 ae.what()
             );
         }
+        catch( const postgres::pool_timeout& pt )
+        {
+            error_code    = show::code::SERVICE_UNAVAILABLE;
+            error_message = "server busy, please try again later";
+            error_headers[ "Retry-After" ] = {
+                std::to_string( current_settings().server.retry_after_seconds )
+            };
+            STICKERS_LOG(
+                log_level::WARNING,
+                "failed to serve ",
+                request.method(),
+                " request from ",
+                request.client_address(),
+                ": ",
+                pt.what()
+            );
+        }
+        catch( const password_hashing_busy& phb )
+        {
+            error_code    = show::code::TOO_MANY_REQUESTS;
+            error_message = "too many attempts, please try again later";
+            error_headers[ "Retry-After" ] = {
+                std::to_string( current_settings().server.retry_after_seconds )
+            };
+            STICKERS_LOG(
+                log_level::WARNING,
+                "failed to serve ",
+                request.method(),
+                " request from ",
+                request.client_address(),
+                ": ",
+                phb.what()
+            );
+        }
         catch( const std::exception& e )
         {
             error_code    = show::code::INTERNAL_SERVER_ERROR;
@@ -364,27 +438,28 @@ namespace stickers
         if( !request.unknown_content_length() )
             request.flush();
         
-        if( handler_finished )
-            return;
-        
-        nlj::json error_object{
-            { "message", error_message                   },
-            { "contact", config()[ "server" ][ "admin" ] }
-        };
-        std::string error_json{ error_object.dump() };
-        
-        error_headers[ "Content-Type"   ] = { "application/json" };
-        error_headers[ "Content-Length" ] = {
-            std::to_string( error_json.size() )
-        };
+        if( !handler_finished )
+            send_json_response(
+                request,
+                error_code,
+                {
+                    { "message", error_message                    },
+                    { "contact", current_settings().server.admin }
+                },
+                error_headers
+            );
         
-        show::response response{
-            request.connection(),
-            show::HTTP_1_1,
-            error_code,
-            error_headers
+        access_record record{
+            request.method(),
+            route_template,
+            request.client_address(),
+            noted_status(),
+            request.unknown_content_length() ? 0 : request.content_length(),
+            noted_bytes_out(),
+            std::chrono::steady_clock::now() - started,
+            current_request_timings()
         };
-        
-        response.sputn( error_json.c_str(), error_json.size() );
+        record_request_metrics( routed, record );
+        write_access_record( record );
     }
 }
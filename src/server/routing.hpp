@@ -3,12 +3,17 @@
 #define STICKERS_MOE_SERVER_ROUTING_HPP
 
 
+#include "route_table.hpp"
+
 #include <show.hpp>
 
 
 namespace stickers
 {
     void route_request( show::request& );
+    
+    // The table `route_request()` dispatches through
+    const route_table& request_routes();
 }
 
 
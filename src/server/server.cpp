@@ -4,17 +4,26 @@
 #include "server.hpp"
 
 #include "routing.hpp"
+#include "../common/auth.hpp"
 #include "../common/config.hpp"
+#include "../common/json.hpp"
 #include "../common/timestamp.hpp"
 #include "../common/logging.hpp"
+#include "../common/password_hashing.hpp"
+#include "../common/postgres.hpp"
+#include "../common/request_arena.hpp"
+#include "../common/worker_pool.hpp"
 
 #include <show.hpp>
 #include <show/constants.hpp>
 
-#include <list>
+#include <atomic>
+#include <functional> // std::ref()
+#include <memory>   // std::unique_ptr
 #include <mutex>
 #include <sstream>
-#include <thread> 
+#include <thread>
+#include <vector>
 
 
 // Request global time handling ------------------------------------------------
@@ -44,8 +53,86 @@ namespace stickers
 
 namespace
 {
-    std::mutex worker_count_mutex;
-    unsigned long long worker_count{ 0 };
+    // Created by `run_server()`; kept here so load can be reported elsewhere
+    std::unique_ptr< stickers::worker_pool > connection_workers;
+    
+    // Workers waiting on a connection between requests rather than serving one
+    std::atomic< std::size_t > idle_workers{ 0 };
+    
+    void reject_connection( show::connection& );
+    void handle_connection( show::connection* );
+    
+    // Hands a newly-accepted connection to the worker pool, or rejects it if
+    // the pool is saturated
+    void dispatch_connection( show::connection* connection )
+    {
+        // Owned here until a worker takes it, so it's freed however rejecting
+        // the connection ends
+        std::unique_ptr< show::connection > owned{ connection };
+        
+        // Workers idling between requests give their connection up within a
+        // second of anything being queued, so each counts as a free slot
+        if( connection_workers -> try_enqueue(
+            [ connection ]{ handle_connection( connection ); },
+            idle_workers.load()
+        ) )
+            owned.release();
+        else
+            reject_connection( *connection );
+    }
+    
+    // Waits for the start of a keep-alive connection's next request, returning
+    // `false` if the connection should be closed instead.  show doesn't expose
+    // its sockets, so idle connections can't be multiplexed onto a readiness
+    // wait; instead they're shed: the worker waits in one-second slices (show's
+    // shortest timeout) and gives the connection up as soon as other
+    // connections are queued for a worker, or once it's been idle for
+    // `keep_alive_idle_seconds`.
+    bool await_request( show::connection& connection )
+    {
+        // Pipelined requests that have already arrived
+        if( connection.in_avail() > 0 )
+            return true;
+        
+        auto& server_settings{ stickers::current_settings().server };
+        bool ready{ false };
+        
+        ++idle_workers;
+        connection.timeout( 1 );
+        
+        try
+        {
+            for(
+                unsigned int waited{ 0 };
+                waited < server_settings.keep_alive_idle_seconds;
+                ++waited
+            )
+            {
+                try
+                {
+                    // Blocks until a byte arrives without consuming it
+                    connection.sgetc();
+                    ready = true;
+                    break;
+                }
+                catch( const show::connection_timeout& ct )
+                {}
+                
+                if( connection_workers -> queue_depth() > 0 )
+                    break;
+            }
+        }
+        catch( ... )
+        {
+            --idle_workers;
+            throw;
+        }
+        
+        --idle_workers;
+        connection.timeout( server_settings.wait_for_connection );
+        
+        return ready;
+    }
     
     void handle_connection( show::connection* connection )
     {
@@ -60,20 +147,40 @@ namespace
             worker_id.str()
         );
         
+        // A new connection's first request gets the full `wait_for_connection`
+        // as it always has; only idle keep-alive connections are shed
         connection -> timeout(
-            stickers::config()[ "server" ][ "wait_for_connection" ]
+            stickers::current_settings().server.wait_for_connection
         );
+        bool first_request{ true };
         
         while( true )
             try
             {
+                if( !first_request && !await_request( *connection ) )
+                {
+                    STICKERS_LOG(
+                        stickers::log_level::VERBOSE,
+                        "closing idle connection from ",
+                        connection -> client_address()
+                    );
+                    break;
+                }
+                
                 show::request request{ *connection };
+                first_request = false;
                 
+                // Pick up any reloaded config between requests, never during
+                stickers::refresh_config();
                 set_request_time_to_now();
                 
+                // Nothing from this worker's last request is still alive
+                stickers::current_request_arena().reset();
+                
                 stickers::route_request( request );
                 
                 // HTTP/1.1 support
+                bool keep_alive{ request.protocol() > show::HTTP_1_0 };
                 auto connection_header{ request.headers().find(
                     "Connection"
                 ) };
@@ -86,11 +193,14 @@ namespace
                         connection_header -> second[ 0 ]
                     };
                     if( ch_val == "keep-alive" )
-                        continue;
+                        keep_alive = true;
                     else if( ch_val == "close" )
-                        break;
+                        keep_alive = false;
                 }
-                if( request.protocol() <= show::HTTP_1_0 )
+                
+                // Keep-alive connections stay on this worker only while
+                // `await_request()` lets them
+                if( !keep_alive )
                     break;
             }
             catch( const show::request_parse_error& rpe )
@@ -139,63 +249,196 @@ namespace
         
         delete connection;
         
-        {
-            std::lock_guard< std::mutex > guard{ worker_count_mutex };
-            --worker_count;
-        }
-        
         STICKERS_LOG(
             stickers::log_level::VERBOSE,
             "cleaning up worker ",
             worker_id.str()
         );
     }
-}
-
-namespace stickers
-{
-    void run_server()
+    
+    // Used when the worker pool's queue is full; tells the client to back off
+    // rather than letting the backlog grow without bound
+    void reject_connection( show::connection& connection )
     {
-        show::server server{
-            stickers::config()[ "server" ][ "host" ],
-            stickers::config()[ "server" ][ "port" ],
-            stickers::config()[ "server" ][ "wait_for_connection" ]
-        };
+        STICKERS_LOG(
+            stickers::log_level::WARNING,
+            "worker queue full, rejecting connection from ",
+            connection.client_address()
+        );
         
+        try
+        {
+            // Don't rely on whatever timeout the connection was last given;
+            // a zero timeout would fail any write that can't finish at once
+            connection.timeout(
+                stickers::current_settings().server.wait_for_connection
+            );
+            
+            nlj::json error_object{
+                { "message", "server overloaded, please try again later" },
+                { "contact", stickers::current_settings().server.admin   }
+            };
+            std::string error_json{ error_object.dump() };
+            
+            show::response response{
+                connection,
+                show::HTTP_1_1,
+                show::code::SERVICE_UNAVAILABLE,
+                {
+                    show::server_header,
+                    { "Content-Type"  , { "application/json" } },
+                    { "Content-Length", {
+                        std::to_string( error_json.size() )
+                    } },
+                    { "Retry-After", { std::to_string(
+                        stickers::current_settings().server.retry_after_seconds
+                    ) } },
+                    { "Connection", { "close" } }
+                }
+            };
+            
+            response.sputn( error_json.c_str(), error_json.size() );
+        }
+        catch( const show::connection_timeout& ct )
+        {
+            STICKERS_LOG(
+                stickers::log_level::VERBOSE,
+                "timed out sending rejection to ",
+                connection.client_address()
+            );
+        }
+        catch( const show::connection_interrupted& ci )
+        {}
+        catch( const std::exception& e )
+        {
+            STICKERS_LOG(
+                stickers::log_level::ERROR,
+                "failed to send rejection to ",
+                connection.client_address(),
+                ": ",
+                e.what()
+            );
+        }
+    }
+    
+    // Acceptor loop; only hands connections off to the worker pool.  There's
+    // one per listening socket, as `show::server::serve()` isn't known to be
+    // safe to call concurrently & show gives no way to share a port between
+    // sockets with `SO_REUSEPORT`.
+    void accept_connections( show::server& server )
+    {
         while( true )
         {
+            stickers::refresh_config();
+            
             try
             {
-                auto connection{ new show::connection{ server.serve() } };
-                
-                std::lock_guard< std::mutex > guard{ worker_count_mutex };
-                ++worker_count;
-                
-                std::thread worker{
-                    handle_connection,
-                    connection
-                };
-                worker.detach();
+                dispatch_connection(
+                    new show::connection{ server.serve() }
+                );
             }
             catch( const show::connection_timeout& ct )
             {
                 STICKERS_LOG(
-                    log_level::VERBOSE,
+                    stickers::log_level::VERBOSE,
                     "timed out waiting for connection, looping..."
                 );
             }
             
-            if( current_log_level() >= log_level::VERBOSE )
+            if( stickers::current_log_level() >= stickers::log_level::VERBOSE )
             {
-                std::lock_guard< std::mutex > guard{ worker_count_mutex };
-                if( worker_count > 0 )
+                auto load{ stickers::current_server_load() };
+                if( load.busy_workers > 0 || load.queued_connections > 0 )
                     STICKERS_LOG(
-                        log_level::VERBOSE,
+                        stickers::log_level::VERBOSE,
                         "currently serving ",
-                        worker_count,
-                        " connections"
+                        load.busy_workers,
+                        "/",
+                        load.workers,
+                        " connections with ",
+                        load.queued_connections,
+                        "/",
+                        load.queue_capacity,
+                        " queued"
                     );
             }
         }
     }
 }
+
+namespace stickers
+{
+    server_load current_server_load()
+    {
+        if( !connection_workers )
+            return { 0, 0, 0, 0, 0 };
+        
+        return {
+            connection_workers -> worker_count  (),
+            connection_workers -> busy_count    (),
+            idle_workers.load(),
+            connection_workers -> queue_depth   (),
+            connection_workers -> queue_capacity()
+        };
+    }
+    
+    void run_server()
+    {
+        // Copy rather than reference, this outlives any one config snapshot
+        auto server_settings{ current_settings().server };
+        
+        // The first is accepted on by this thread, the rest by their own
+        std::vector< std::unique_ptr< show::server > > servers;
+        servers.push_back( std::make_unique< show::server >(
+            server_settings.host,
+            server_settings.port,
+            server_settings.wait_for_connection
+        ) );
+        for( auto extra_port : server_settings.extra_ports )
+            servers.push_back( std::make_unique< show::server >(
+                server_settings.host,
+                extra_port,
+                server_settings.wait_for_connection
+            ) );
+        
+        connection_workers = std::make_unique< worker_pool >(
+            server_settings.worker_threads,
+            server_settings.max_queued_connections
+        );
+        
+        start_password_hashing();
+        
+        try
+        {
+            postgres::warm_connection_pool();
+        }
+        catch( const std::exception& e )
+        {
+            // Not fatal, connections will be opened as requests need them
+            STICKERS_LOG(
+                log_level::WARNING,
+                "could not open initial PostgreSQL connections: ",
+                e.what()
+            );
+        }
+        
+        listen_for_permission_changes();
+        
+        STICKERS_LOG(
+            log_level::INFO,
+            "serving with ",
+            connection_workers -> worker_count(),
+            " workers and a queue of up to ",
+            connection_workers -> queue_capacity(),
+            " connections, accepting on ",
+            servers.size(),
+            " port",
+            ( servers.size() == 1 ? "" : "s" )
+        );
+        
+        for( std::size_t i = 1; i < servers.size(); ++i )
+            std::thread{ accept_connections, std::ref( *servers[ i ] ) }.detach();
+        
+        accept_connections( *servers[ 0 ] );
+    }
+}
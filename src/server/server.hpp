@@ -3,9 +3,24 @@
 #define STICKERS_MOE_SERVER_SERVER_HPP
 
 
+#include <cstddef>  // std::size_t
+
+
 namespace stickers
 {
+    struct server_load
+    {
+        std::size_t workers;
+        std::size_t busy_workers;
+        std::size_t idle_workers;       // Busy, but waiting between requests
+        std::size_t queued_connections;
+        std::size_t queue_capacity;
+    };
+    
     void run_server();
+    
+    // Snapshot of the connection worker pool; all zeroes before `run_server()`
+    server_load current_server_load();
 }
 
 
@@ -0,0 +1,610 @@
+#line 2 "utilities/benchmark.cpp"
+
+
+#include "../api/design.hpp"
+#include "../api/person.hpp"
+#include "../api/shop.hpp"
+#include "../api/user.hpp"
+#include "../common/config.hpp"
+#include "../common/formatting.hpp"
+#include "../common/json.hpp"
+#include "../common/request_arena.hpp"
+#include "../common/string_utils.hpp"
+#include "../server/parse.hpp"
+#include "../server/routing.hpp"
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>    // std::modf()
+#include <cstdlib>  // std::stoul(), std::malloc(), std::free()
+#include <functional>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace // Allocation counting ///////////////////////////////////////////////
+{
+    std::atomic< unsigned long long > allocation_count{ 0 };
+    std::atomic< long long >          allocated_bytes { 0 };
+    std::atomic< long long >          peak_bytes      { 0 };
+    
+    // Each allocation is prefixed with its size so `delete` can subtract it;
+    // 16 bytes keeps the result aligned for any fundamental type
+    constexpr std::size_t size_prefix{ 16 };
+}
+
+void* operator new( std::size_t size )
+{
+    auto block{ static_cast< char* >( std::malloc( size + size_prefix ) ) };
+    if( !block )
+        throw std::bad_alloc{};
+    *reinterpret_cast< std::size_t* >( block ) = size;
+    
+    ++allocation_count;
+    auto now_allocated{ allocated_bytes += size };
+    auto peak{ peak_bytes.load() };
+    while(
+        now_allocated > peak
+        && !peak_bytes.compare_exchange_weak( peak, now_allocated )
+    );
+    
+    return block + size_prefix;
+}
+
+void operator delete( void* pointer ) noexcept
+{
+    if( !pointer )
+        return;
+    auto block{ static_cast< char* >( pointer ) - size_prefix };
+    allocated_bytes -= *reinterpret_cast< std::size_t* >( block );
+    std::free( block );
+}
+
+void operator delete( void* pointer, std::size_t ) noexcept
+{
+    operator delete( pointer );
+}
+
+
+namespace // Accept throughput /////////////////////////////////////////////////
+{
+    // Opens a connection, sends a minimal HTTP/1.0 request, & reads until the
+    // server closes the connection
+    bool connect_once( const addrinfo& address )
+    {
+        static const std::string request{ "OPTIONS / HTTP/1.0\r\n\r\n" };
+        
+        auto descriptor{ socket(
+            address.ai_family,
+            address.ai_socktype,
+            address.ai_protocol
+        ) };
+        if( descriptor < 0 )
+            return false;
+        
+        bool completed{ false };
+        
+        if(
+            connect( descriptor, address.ai_addr, address.ai_addrlen ) == 0
+            && send( descriptor, request.c_str(), request.size(), 0 )
+                == static_cast< ssize_t >( request.size() )
+        )
+        {
+            char buffer[ 1024 ];
+            ssize_t received;
+            while( ( received = recv(
+                descriptor,
+                buffer,
+                sizeof( buffer ),
+                0
+            ) ) > 0 );
+            completed = received == 0;
+        }
+        
+        close( descriptor );
+        return completed;
+    }
+    
+    int benchmark_accept( int argc, char* argv[] )
+    {
+        if( argc < 6 )
+        {
+            ff::writeln(
+                std::cerr,
+                "usage: ",
+                argv[ 0 ],
+                (
+                    " accept host port[,port...] client_threads "
+                    "connections_per_thread"
+                )
+            );
+            return -1;
+        }
+        
+        std::string host{ argv[ 2 ] };
+        auto ports{ stickers::split< std::vector< std::string > >(
+            argv[ 3 ],
+            ","
+        ) };
+        auto client_threads        { std::stoul( argv[ 4 ] ) };
+        auto connections_per_thread{ std::stoul( argv[ 5 ] ) };
+        
+        addrinfo hints{};
+        hints.ai_family   = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        
+        // One per port; client threads are spread over them round-robin so a
+        // server accepting on several ports can be compared against one
+        std::vector< addrinfo* > addresses;
+        for( const auto& port : ports )
+        {
+            addrinfo* port_addresses{ nullptr };
+            if( getaddrinfo(
+                host.c_str(),
+                port.c_str(),
+                &hints,
+                &port_addresses
+            ) != 0 || !port_addresses )
+            {
+                ff::writeln( std::cerr, "could not resolve ", host, ":", port );
+                for( auto address : addresses )
+                    freeaddrinfo( address );
+                return -1;
+            }
+            addresses.push_back( port_addresses );
+        }
+        
+        std::atomic< unsigned long > succeeded{ 0 };
+        std::atomic< unsigned long >    failed{ 0 };
+        std::vector< std::thread > clients;
+        
+        auto start{ std::chrono::steady_clock::now() };
+        
+        for( unsigned long i = 0; i < client_threads; ++i )
+            clients.emplace_back( [
+                &,
+                address = addresses[ i % addresses.size() ]
+            ]{
+                for( unsigned long j = 0; j < connections_per_thread; ++j )
+                    if( connect_once( *address ) )
+                        ++succeeded;
+                    else
+                        ++failed;
+            } );
+        for( auto& client : clients )
+            client.join();
+        
+        std::chrono::duration< double > elapsed{
+            std::chrono::steady_clock::now() - start
+        };
+        
+        for( auto address : addresses )
+            freeaddrinfo( address );
+        
+        ff::writeln(
+            std::cout,
+            "connections: ",
+            std::to_string( succeeded.load() ),
+            " succeeded, ",
+            std::to_string( failed.load() ),
+            " failed in ",
+            std::to_string( elapsed.count() ),
+            "s (",
+            std::to_string( succeeded.load() / elapsed.count() ),
+            " connections/s)"
+        );
+        
+        return 0;
+    }
+}
+
+
+namespace // Query execution ///////////////////////////////////////////////////
+{
+    void time_query(
+        const std::string            & name,
+        unsigned long                  iterations,
+        const std::function< void() >& query
+    )
+    {
+        // Make sure a connection is open & the statement prepared before timing
+        query();
+        
+        auto start{ std::chrono::steady_clock::now() };
+        for( unsigned long i = 0; i < iterations; ++i )
+            query();
+        std::chrono::duration< double, std::micro > elapsed{
+            std::chrono::steady_clock::now() - start
+        };
+        
+        ff::writeln(
+            std::cout,
+            "    ",
+            name,
+            ": ",
+            std::to_string( elapsed.count() / iterations ),
+            "us/call"
+        );
+    }
+    
+    // Compares parameterized queries against prepared statements on the
+    // lookups behind the common GET endpoints; IDs must refer to existing
+    // records
+    int benchmark_queries( int argc, char* argv[] )
+    {
+        if( argc < 5 )
+        {
+            ff::writeln(
+                std::cerr,
+                "usage: ",
+                argv[ 0 ],
+                " queries config.json iterations user_id"
+                " [person_id [shop_id [design_id]]]"
+            );
+            return -1;
+        }
+        
+        stickers::open_config( argv[ 2 ] );
+        nlj::json base_config{ stickers::config() };
+        
+        auto iterations{ std::stoul( argv[ 3 ] ) };
+        std::vector< stickers::bigid > ids;
+        for( int i = 4; i < argc; ++i )
+            ids.push_back( stickers::bigid::from_string( argv[ i ] ) );
+        
+        for( bool prepared : { false, true } )
+        {
+            base_config[ "database" ][ "prepared_statements" ] = prepared;
+            stickers::set_config( base_config );
+            
+            ff::writeln(
+                std::cout,
+                prepared ? "prepared statements:" : "parameterized queries:"
+            );
+            
+            time_query( "load_user", iterations, [ & ]{
+                stickers::load_user( ids[ 0 ] );
+            } );
+            if( ids.size() > 1 )
+                time_query( "load_person", iterations, [ & ]{
+                    stickers::load_person( ids[ 1 ] );
+                } );
+            if( ids.size() > 2 )
+                time_query( "load_shop", iterations, [ & ]{
+                    stickers::load_shop( ids[ 2 ] );
+                } );
+            if( ids.size() > 3 )
+                time_query( "load_design", iterations, [ & ]{
+                    stickers::load_design( ids[ 3 ] );
+                } );
+        }
+        
+        return 0;
+    }
+}
+
+
+namespace // Routing ///////////////////////////////////////////////////////////
+{
+    struct route_sample
+    {
+        std::vector< std::string > path;
+        std::string                method;
+    };
+    
+    // Times matching a path & method against every route the server handles,
+    // with variable elements filled in by a sample ID
+    int benchmark_routes( int argc, char* argv[] )
+    {
+        if( argc < 3 )
+        {
+            ff::writeln(
+                std::cerr,
+                "usage: ",
+                argv[ 0 ],
+                " routes iterations"
+            );
+            return -1;
+        }
+        
+        auto iterations{ std::stoul( argv[ 2 ] ) };
+        auto& routes{ stickers::request_routes() };
+        
+        std::vector< route_sample > samples;
+        for( auto& node : routes.nodes() )
+            for( std::size_t i = 0; i < stickers::http_method_count; ++i )
+            {
+                if( !node.handlers[ i ] )
+                    continue;
+                
+                route_sample sample{
+                    {},
+                    stickers::http_method_name(
+                        static_cast< stickers::http_method >( i )
+                    )
+                };
+                for( auto element : stickers::split( node.route, "/" ) )
+                    if( element.empty() )
+                        continue;
+                    else if( element[ 0 ] == '{' )
+                        sample.path.emplace_back( "1234567890123456" );
+                    else
+                        sample.path.emplace_back( element );
+                
+                samples.push_back( std::move( sample ) );
+            }
+        
+        unsigned long matched{ 0 };
+        
+        auto start{ std::chrono::steady_clock::now() };
+        for( unsigned long i = 0; i < iterations; ++i )
+            for( auto& sample : samples )
+            {
+                stickers::handler_vars_type variables;
+                auto match{ routes.find( sample.path, variables ) };
+                auto method{ stickers::parse_http_method( sample.method ) };
+                if(
+                    match.found
+                    && method
+                    && match.found -> handlers[
+                        static_cast< std::size_t >( *method )
+                    ]
+                )
+                    ++matched;
+            }
+        std::chrono::duration< double, std::nano > elapsed{
+            std::chrono::steady_clock::now() - start
+        };
+        
+        auto lookups{ iterations * samples.size() };
+        ff::writeln(
+            std::cout,
+            std::to_string( samples.size() ),
+            " routes, ",
+            std::to_string( matched ),
+            "/",
+            std::to_string( lookups ),
+            " lookups matched, ",
+            std::to_string( elapsed.count() / lookups ),
+            "ns/lookup"
+        );
+        
+        return matched == lookups ? 0 : -1;
+    }
+}
+
+
+namespace // JSON parsing //////////////////////////////////////////////////////
+{
+    // Request bodies like those the create & edit handlers accept
+    const std::vector< std::pair< std::string, std::string > > json_payloads{
+        { "user", R"###({
+            "display_name": "Kiyoshi Tsukimi",
+            "real_name": "\u6708\u898b \u6f54",
+            "email": "kiyoshi@example.com",
+            "password": "correct horse battery staple",
+            "avatar": "9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08"
+        })###" },
+        { "shop", R"###({
+            "name": "Sticker Mule-ish",
+            "url": "https://shop.example.com/stickers",
+            "founded": "2014-03-01T00:00:00Z",
+            "closed": null,
+            "owner_person_id": "1521523897162145792",
+            "links": [
+                "https://twitter.com/example",
+                "https://instagram.com/example"
+            ]
+        })###" },
+        { "design", R"###({
+            "description": "Holographic die-cut vinyl, 3\" on the long side, limited run of 200 with \"glitter\" variant",
+            "images": [
+                "9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08",
+                "60303ae22b998861bce3b28f33eec1be758a213c86c93c076dbe9f558c11c752",
+                "fd61a03af4f77d870fc21e05e7e80678095c92d808cfb3b5c279ee04c74aca13",
+                "a4e624d686e03ed2767c0abd85c14426b0b1157d2ce81d27bb4fe4f6f01d688a",
+                "2c26b46b68ffc68ff99b453c1d30413413422d706483bfa0f98a5e886266e7ae",
+                "fcde2b2edba56bf408601fb721fe9b5c338d10ee429ea04fae5511b68fbf8fb9"
+            ],
+            "contributors": [
+                "1521523897162145792",
+                "1521523897162145793",
+                "1521523897162145794"
+            ]
+        })###" }
+    };
+    
+    // A design with a long image list, where per-element overhead dominates
+    std::string large_array_payload( std::size_t elements )
+    {
+        std::string hash( 64, 'f' );
+        std::string payload{ R"###({"description": "", "images": [)###" };
+        for( std::size_t i = 0; i < elements; ++i )
+            payload += ( i ? ", \"" : "\"" ) + hash + "\"";
+        return payload + R"###(], "contributors": []})###";
+    }
+    
+    // The previous approach: parse into an `nlj::json` DOM, then copy it
+    stickers::document dom_to_document( nlj::json& parsed )
+    {
+        if( parsed.is_null() )
+            return stickers::null_document{};
+        else if( parsed.is_boolean() )
+            return parsed.get< bool >();
+        else if( parsed.is_number() )
+        {
+            double integer_part;
+            if( std::modf( parsed.get< double >(), &integer_part ) != 0 )
+                return parsed.get< double >();
+            else
+                return parsed.get< long >();
+        }
+        else if( parsed.is_object() )
+        {
+            stickers::document doc{ stickers::map_document{} };
+            for( auto pair = parsed.begin(); pair != parsed.end(); ++pair )
+                doc.get< stickers::map_document >()[ pair.key() ] =
+                    dom_to_document( pair.value() );
+            return doc;
+        }
+        else if( parsed.is_array() )
+        {
+            stickers::document doc{ stickers::array_document{} };
+            auto& array{ doc.get< stickers::array_document >() };
+            array.reserve( parsed.size() );
+            for( auto& element : parsed )
+                array.emplace_back( dom_to_document( element ) );
+            return doc;
+        }
+        else
+            return std::move( parsed.get< std::string >() );
+    }
+    
+    stickers::document parse_via_dom( std::streambuf& buffer )
+    {
+        nlj::json parsed;
+        std::istream stream{ &buffer };
+        stream >> parsed;
+        return dom_to_document( parsed );
+    }
+    
+    void time_json_parse(
+        const std::string& name,
+        const std::string& payload,
+        unsigned long      iterations,
+        stickers::document ( *parse )( std::streambuf& )
+    )
+    {
+        // Parsed documents are allocated from the request arena, which the
+        // server resets between requests; make sure its first block already
+        // exists so it isn't counted
+        auto& arena{ stickers::current_request_arena() };
+        arena.reset();
+        
+        // One parse on its own for the peak memory
+        long long baseline;
+        unsigned long long allocations;
+        {
+            std::stringbuf buffer{ payload };
+            baseline    = allocated_bytes;
+            peak_bytes  = baseline;
+            allocations = allocation_count;
+            
+            parse( buffer );
+            
+            allocations = allocation_count - allocations;
+        }
+        arena.reset();
+        auto peak{ peak_bytes - baseline };
+        
+        auto start{ std::chrono::steady_clock::now() };
+        for( unsigned long i = 0; i < iterations; ++i )
+        {
+            std::stringbuf buffer{ payload };
+            parse( buffer );
+            arena.reset();
+        }
+        std::chrono::duration< double, std::micro > elapsed{
+            std::chrono::steady_clock::now() - start
+        };
+        
+        ff::writeln(
+            std::cout,
+            "    ",
+            name,
+            ": ",
+            std::to_string( elapsed.count() / iterations ),
+            "us/parse, ",
+            std::to_string( allocations ),
+            " allocations, ",
+            std::to_string( peak ),
+            " bytes peak"
+        );
+    }
+    
+    // Compares parsing into an `nlj::json` DOM & converting it against the
+    // streaming parser `parse_request_content()` uses for JSON bodies
+    int benchmark_json( int argc, char* argv[] )
+    {
+        if( argc < 3 )
+        {
+            ff::writeln(
+                std::cerr,
+                "usage: ",
+                argv[ 0 ],
+                " json iterations"
+            );
+            return -1;
+        }
+        
+        auto iterations{ std::stoul( argv[ 2 ] ) };
+        
+        auto payloads{ json_payloads };
+        payloads.emplace_back( "large array", large_array_payload( 1000 ) );
+        
+        for( auto& [ name, payload ] : payloads )
+        {
+            ff::writeln(
+                std::cout,
+                name,
+                " (",
+                std::to_string( payload.size() ),
+                " bytes):"
+            );
+            time_json_parse( "DOM", payload, iterations, parse_via_dom );
+            time_json_parse(
+                "streaming",
+                payload,
+                iterations,
+                stickers::parse_json_content
+            );
+        }
+        
+        return 0;
+    }
+}
+
+
+int main( int argc, char* argv[] )
+{
+    std::string mode{ argc < 2 ? "" : argv[ 1 ] };
+    
+    try
+    {
+        if( mode == "accept" )
+            return benchmark_accept( argc, argv );
+        else if( mode == "queries" )
+            return benchmark_queries( argc, argv );
+        else if( mode == "routes" )
+            return benchmark_routes( argc, argv );
+        else if( mode == "json" )
+            return benchmark_json( argc, argv );
+        
+        ff::writeln(
+            std::cerr,
+            "usage: ",
+            argv[ 0 ],
+            " accept|queries|routes|json ..."
+        );
+        return -1;
+    }
+    catch( const std::exception &e )
+    {
+        ff::writeln( std::cerr, "uncaught std::exception in main(): ", e.what() );
+        return -1;
+    }
+    catch( ... )
+    {
+        ff::writeln( std::cerr, "uncaught non-std::exception in main()" );
+        return -1;
+    }
+}
@@ -56,7 +56,21 @@ int main( int argc, char* argv[] )
                 return 2;
             }
             
-            stickers::set_config( config );
+            try
+            {
+                stickers::set_config( config );
+            }
+            catch( const stickers::config_error& e )
+            {
+                STICKERS_LOG(
+                    stickers::log_level::ERROR,
+                    "invalid config file ",
+                    argv[ 1 ],
+                    ": ",
+                    e.what()
+                );
+                return -1;
+            }
         }
         
         auto pw{ stickers::hash_password( argv[ 2 ] ) };